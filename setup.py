@@ -55,6 +55,12 @@ ext_modules = [
             'xmlwriter/cpy/pbXmlWrite.cpp',
             'xmlwriter/cpy/XmlWrite_docs.cpp',
             'xmlwriter/cpp/XmlWrite.cpp',
+            'xmlwriter/cpp/XmlSink.cpp',
+            'xmlwriter/cpp/XmlSinkZlib.cpp',
+            'xmlwriter/cpp/XmlEscape.cpp',
+            'xmlwriter/cpp/XmlAttrs.cpp',
+            'xmlwriter/cpp/XmlNameTable.cpp',
+            'xmlwriter/cpp/XmlCommandBuffer.cpp',
             'xmlwriter/cpp/base64.cpp',
         ],
         include_dirs=[
@@ -63,6 +69,8 @@ ext_modules = [
             get_pybind_include(),
             get_pybind_include(user=True)
         ],
+        # XmlSinkZlib
+        libraries=['z'],
         language='c++'
     ),
     # CPython wrapper to the C++ XmlStream
@@ -72,6 +80,12 @@ ext_modules = [
             'xmlwriter/cpy/cXmlWrite.cpp',
             'xmlwriter/cpy/XmlWrite_docs.cpp',
             'xmlwriter/cpp/XmlWrite.cpp',
+            'xmlwriter/cpp/XmlSink.cpp',
+            'xmlwriter/cpp/XmlSinkZlib.cpp',
+            'xmlwriter/cpp/XmlEscape.cpp',
+            'xmlwriter/cpp/XmlAttrs.cpp',
+            'xmlwriter/cpp/XmlNameTable.cpp',
+            'xmlwriter/cpp/XmlCommandBuffer.cpp',
             'xmlwriter/cpp/base64.cpp',
         ] + CPY_UTILITY_SOURCES,
         include_dirs = [
@@ -79,6 +93,8 @@ ext_modules = [
             'xmlwriter/cpy',
         ] + CPY_UTILITY_HEADER_DIRS,
         library_dirs = [],
+        # XmlSinkZlib
+        libraries=['z'],
 #         extra_compile_args=[],
         language='c++'
     ),
@@ -135,6 +151,11 @@ class BuildExt(build_ext):
             opts.append(cpp_flag(self.compiler))
             if has_flag(self.compiler, '-fvisibility=hidden'):
                 opts.append('-fvisibility=hidden')
+            # XmlSinkThread uses std::thread.
+            if has_flag(self.compiler, '-pthread'):
+                opts.append('-pthread')
+                for ext in self.extensions:
+                    ext.extra_link_args = ['-pthread']
         elif ct == 'msvc':
             opts.append('/DVERSION_INFO=\\"%s\\"' % self.distribution.get_version())
         for ext in self.extensions:
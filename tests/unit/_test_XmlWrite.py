@@ -214,6 +214,206 @@ class TestXmlWrite(unittest.TestCase):
 <Root version="12.0">literal&nbsp;text</Root>
 """)
 
+    def test_10(self):
+        """TestXmlWrite.test_10(): quotes are not escaped in text."""
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, 'Root'):
+                xS.characters(u'George "Shotgun" O\'Ziegler <&>')
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root>George "Shotgun" O'Ziegler &lt;&amp;&gt;</Root>
+""")
+
+    def test_11(self):
+        """TestXmlWrite.test_11(): only double quotes are escaped in attributes."""
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, 'Root', {'name' : 'George "Shotgun" O\'Ziegler <&>'}):
+                pass
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root name="George &quot;Shotgun&quot; O'Ziegler &lt;&amp;>" />
+""")
+
+    def test_12(self):
+        """TestXmlWrite.test_12(): comments are not escaped but '--' is split."""
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, 'Root'):
+                xS.comment(u'<&> a--b---c -')
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root><!--<&> a- -b- - -c - -->
+</Root>
+""")
+
+    def test_13(self):
+        """TestXmlWrite.test_13(): startElement()/endElement() writes attributes sorted by name."""
+        with XmlWrite.XmlStream() as xS:
+            xS.startElement('Root', {'z' : '1', 'a' : '2', 'm' : '3'})
+            xS.startElement('A', {})
+            xS.endElement('A')
+            xS.endElement('Root')
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root a="2" m="3" z="1">
+  <A />
+</Root>
+""")
+
+    def test_14(self):
+        """TestXmlWrite.test_14(): text beyond Latin-1 in names, attributes, text and comments."""
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, u'\u6839', {u'\u540d\u524d' : u'\u0391\u03b2 \U0001f600'}):
+                xS.characters(u'\u4e2d\u6587 <\u20ac> \U0001f600')
+                xS.comment(u'\u2014 \u00e9')
+                xS.literal(u'\u2603')
+                xS.startElement(u'\u00e9l\u00e9ment', {})
+                xS.endElement(u'\u00e9l\u00e9ment')
+        self.assertEqual(xS.getvalue(), u"""<?xml version='1.0' encoding="utf-8"?>
+<\u6839 \u540d\u524d="\u0391\u03b2 \U0001f600">\u4e2d\u6587 &lt;\u20ac&gt; \U0001f600<!--\u2014 \u00e9-->\u2603<\u00e9l\u00e9ment /></\u6839>
+""")
+
+    def test_15(self):
+        """TestXmlWrite.test_15(): writeTree() is the same as startElement()/characters()/endElement()."""
+        with XmlWrite.XmlStream() as xS_incr:
+            xS_incr.startElement('Root', {'version' : '12.0'})
+            xS_incr.startElement('A', {'a' : '1'})
+            xS_incr.startElement('B', {})
+            xS_incr.endElement('B')
+            xS_incr.startElement('C', {'c' : '2'})
+            xS_incr.characters('Text')
+            xS_incr.endElement('C')
+            xS_incr.endElement('A')
+            xS_incr.startElement('D', {})
+            xS_incr.endElement('D')
+            xS_incr.endElement('Root')
+        with XmlWrite.XmlStream() as xS:
+            xS.writeTree(
+                ('Root', {'version' : '12.0'}, [
+                    ('A', {'a' : '1'}, (
+                        ('B', {}),
+                        ['C', {'c' : '2'}, 'Text'],
+                    )),
+                    ('D', None, []),
+                ])
+            )
+        self.assertEqual(xS.getvalue(), xS_incr.getvalue())
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root version="12.0">
+  <A a="1">
+    <B />
+    <C c="2">Text</C>
+  </A>
+  <D />
+</Root>
+""")
+
+    def test_16(self):
+        """TestXmlWrite.test_16(): writeTree() escapes text and attributes and allows mixed content."""
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, 'Root'):
+                xS.writeTree(
+                    ('P', {'title' : 'a "b" <&>'}, ['x < y & ', ('B', None, 'z > w'), ' \u00e9'])
+                )
+        self.assertEqual(xS.getvalue(), u"""<?xml version='1.0' encoding="utf-8"?>
+<Root>
+  <P title="a &quot;b&quot; &lt;&amp;>">x &lt; y &amp; <B>z &gt; w</B> \u00e9</P>
+</Root>
+""")
+
+    def test_17(self):
+        """TestXmlWrite.test_17(): writeTree() raises TypeError for a bad node and closes the elements it opened."""
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, 'Root'):
+                for node in (42, ('A',), ('A', None, [], 1), ('A', None, 42), ('A', None, [('B', None), 42])):
+                    with self.assertRaises(TypeError):
+                        xS.writeTree(node)
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root>
+  <A />
+  <A>
+    <B />
+  </A>
+</Root>
+""")
+
+    def test_18(self):
+        """TestXmlWrite.test_18(): execute() of a CommandBuffer is the same as startElement()/characters()/endElement()."""
+        with XmlWrite.XmlStream() as xS_incr:
+            xS_incr.startElement('Root', {'version' : '12.0'})
+            xS_incr.startElement('A', {'z' : '1', 'a' : '<&">'})
+            xS_incr.characters('x < y')
+            xS_incr.characters(' & z')
+            xS_incr.endElement('A')
+            xS_incr.startElement('B', {})
+            xS_incr.endElement('B')
+            xS_incr.endElement('Root')
+        attrs = {'z' : '1', 'a' : '<&">'}
+        buffer = XmlWrite.CommandBuffer()
+        buffer.start('Root', {'version' : '12.0'})
+        buffer.start('A', attrs)
+        buffer.text('x < y')
+        buffer.text(' & z')
+        buffer.end()
+        buffer.start('B')
+        buffer.end()
+        buffer.end()
+        # The buffer holds a copy.
+        attrs['z'] = '2'
+        with XmlWrite.XmlStream() as xS:
+            xS.execute(buffer)
+        self.assertEqual(xS.getvalue(), xS_incr.getvalue())
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root version="12.0">
+  <A a="&lt;&amp;&quot;>" z="1">x &lt; y &amp; z</A>
+  <B />
+</Root>
+""")
+
+    def test_19(self):
+        """TestXmlWrite.test_19(): a CommandBuffer can be executed in batches and reused after clear()."""
+        buffer = XmlWrite.CommandBuffer()
+        self.assertEqual(len(buffer), 0)
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, 'Root'):
+                buffer.start('A', None)
+                buffer.text('a')
+                self.assertEqual(len(buffer), 2)
+                # Consecutive text is one operation.
+                buffer.text('b')
+                self.assertEqual(len(buffer), 2)
+                xS.execute(buffer)
+                buffer.clear()
+                self.assertEqual(len(buffer), 0)
+                buffer.start('B')
+                buffer.end()
+                buffer.end()
+                xS.execute(buffer)
+                # Executing again repeats the operations.
+                buffer.clear()
+                buffer.start('C')
+                buffer.end()
+                xS.execute(buffer)
+                xS.execute(buffer)
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root>
+  <A>ab<B /></A>
+  <C />
+  <C />
+</Root>
+""")
+
+    def test_20(self):
+        """TestXmlWrite.test_20(): CommandBuffer and execute() errors."""
+        buffer = XmlWrite.CommandBuffer()
+        self.assertRaises(TypeError, buffer.start, 'A', ['a', '1'])
+        self.assertRaises(TypeError, buffer.text, 42)
+        self.assertEqual(len(buffer), 0)
+        with XmlWrite.XmlStream() as xS:
+            self.assertRaises(TypeError, xS.execute, [])
+            buffer.start('A')
+            buffer.end()
+            buffer.end()
+            self.assertRaises(XmlWrite.ExceptionXmlEndElement, xS.execute, buffer)
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<A />
+""")
+
 
 
 class TestXhtmlWrite(unittest.TestCase):
@@ -311,6 +511,21 @@ this line.""")
     <p><br />Break at beginning<br />middle and end<br /></p>
   </body>
 </html>
+""")
+
+    def test_charactersWithBr_01(self):
+        """TestXhtmlWrite.test_charactersWithBr_01(): text beyond Latin-1."""
+        with XmlWrite.XhtmlStream() as xS:
+            with XmlWrite.Element(xS, 'body'):
+                with XmlWrite.Element(xS, 'p'):
+                    xS.charactersWithBr(u'\u4e2d\u6587\n\U0001f600 <\u20ac>')
+        self.assertEqual(xS.getvalue(), u"""<?xml version='1.0' encoding="utf-8"?>
+<!DOCTYPE html PUBLIC "-//W3C//DTD XHTML 1.0 Strict//EN" "http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd">
+<html lang="en" xml:lang="en" xmlns="http://www.w3.org/1999/xhtml">
+  <body>
+    <p>\u4e2d\u6587<br />\U0001f600 &lt;\u20ac&gt;</p>
+  </body>
+</html>
 """)
 
 # ---------- Benchmarks -----------------
@@ -0,0 +1,935 @@
+#!/usr/bin/env python
+"""Tests of the features of the C++ XmlWrite implementation that the pure
+Python XmlWrite does not have.
+
+This is executed by test_cXmlWrite.py and test_pbXmlWrite.py with
+``XmlWrite`` bound to the module under test.
+"""
+import gzip
+import io
+import os
+import pathlib
+import tempfile
+import threading
+import time
+import unittest
+import zlib
+
+
+def _write_XHTML_document(xS):
+    with XmlWrite.Element(xS, 'head'):
+        with XmlWrite.Element(xS, 'title'):
+            xS.characters(u'Virtual Library')
+    with XmlWrite.Element(xS, 'body'):
+        for i in range(64):
+            with XmlWrite.Element(xS, 'p', {'class' : 'para_%d' % i}):
+                xS.characters(u'Moved to ')
+                with XmlWrite.Element(xS, 'a', {'href' : 'http://example.org/'}):
+                    xS.characters(u'example.org')
+                xS.characters(u' since >"2015".')
+
+
+def _expected_XHTML_document():
+    with XmlWrite.XhtmlStream() as xS:
+        _write_XHTML_document(xS)
+    return xS.getvalue()
+
+
+def _write_to_pipe_read_by_thread(write):
+    """Calls write(fd) with the write end of a pipe that is read by a Python
+    thread and returns the bytes read. This deadlocks if a blocked write
+    holds the GIL."""
+    read_fd, write_fd = os.pipe()
+    chunks = []
+
+    def read():
+        with os.fdopen(read_fd, 'rb') as f:
+            chunks.append(f.read())
+
+    thread = threading.Thread(target=read)
+    thread.start()
+    try:
+        write(write_fd)
+    finally:
+        os.close(write_fd)
+        thread.join()
+    return chunks[0]
+
+
+class TestXmlStreamFile(unittest.TestCase):
+    """Tests writing an XmlStream directly to a file."""
+    def setUp(self):
+        fd, self.path = tempfile.mkstemp(suffix='.xml')
+        os.close(fd)
+
+    def tearDown(self):
+        os.remove(self.path)
+
+    def _read(self):
+        with open(self.path) as f:
+            return f.read()
+
+    def test_path(self):
+        with XmlWrite.XhtmlStream(theFile=self.path) as xS:
+            _write_XHTML_document(xS)
+        self.assertEqual(self._read(), _expected_XHTML_document())
+
+    def test_path_small_flush_size(self):
+        with XmlWrite.XhtmlStream(theFile=self.path, flushSize=16) as xS:
+            _write_XHTML_document(xS)
+        self.assertEqual(self._read(), _expected_XHTML_document())
+
+    def test_file_descriptor(self):
+        fd = os.open(self.path, os.O_WRONLY)
+        try:
+            with XmlWrite.XhtmlStream(theFile=fd, flushSize=64) as xS:
+                _write_XHTML_document(xS)
+        finally:
+            os.close(fd)
+        self.assertEqual(self._read(), _expected_XHTML_document())
+
+    def test_path_like(self):
+        with XmlWrite.XhtmlStream(theFile=pathlib.Path(self.path)) as xS:
+            _write_XHTML_document(xS)
+        self.assertEqual(self._read(), _expected_XHTML_document())
+
+    def test_text_file(self):
+        with open(self.path, 'w') as f:
+            with XmlWrite.XhtmlStream(theFile=f) as xS:
+                _write_XHTML_document(xS)
+        self.assertEqual(self._read(), _expected_XHTML_document())
+
+    def test_getvalue_raises(self):
+        with XmlWrite.XmlStream(theFile=self.path) as xS:
+            pass
+        self.assertRaises(XmlWrite.ExceptionXml, xS.getvalue)
+
+    def test_bad_path_raises(self):
+        self.assertRaises(XmlWrite.ExceptionXml, XmlWrite.XmlStream,
+                          theFile=os.path.join(self.path, 'no_such_dir', 'f.xml'))
+
+    def test_bool_raises(self):
+        self.assertRaises(TypeError, XmlWrite.XmlStream, theFile=True)
+        self.assertRaises(TypeError, XmlWrite.XmlStream, theFile=False)
+
+    def test_bad_file_descriptor_raises(self):
+        self.assertRaises(ValueError, XmlWrite.XmlStream, theFile=-1)
+        self.assertRaises(OverflowError, XmlWrite.XmlStream, theFile=2**32 + 2)
+
+    def test_pipe_read_by_thread(self):
+        text = 'text ' * 200000
+
+        def write(fd):
+            with XmlWrite.XmlStream(theFile=fd) as xS:
+                with XmlWrite.Element(xS, 'Root'):
+                    xS.characters(text)
+
+        self.assertEqual(
+            _write_to_pipe_read_by_thread(write).decode('utf-8'),
+            """<?xml version='1.0' encoding="utf-8"?>\n<Root>%s</Root>\n""" % text,
+        )
+
+    def test_use_while_flushing_raises(self):
+        read_fd, write_fd = os.pipe()
+        errors = []
+        xS = XmlWrite.XmlStream(theFile=write_fd)
+
+        def use_then_read():
+            # The main thread is blocked writing to the full pipe.
+            time.sleep(0.2)
+            try:
+                xS.characters('x')
+            except XmlWrite.ExceptionXml as err:
+                errors.append(err)
+            with os.fdopen(read_fd, 'rb') as f:
+                f.read()
+
+        thread = threading.Thread(target=use_then_read)
+        thread.start()
+        try:
+            with xS:
+                with XmlWrite.Element(xS, 'Root'):
+                    xS.characters('text ' * 200000)
+        finally:
+            os.close(write_fd)
+            thread.join()
+        self.assertEqual(len(errors), 1)
+
+
+class _CountingWriter(object):
+    """A binary file like object that records each call to write()."""
+    def __init__(self):
+        self.chunks = []
+
+    def write(self, chunk):
+        self.chunks.append(chunk)
+        return len(chunk)
+
+
+class TestXmlStreamFileLike(unittest.TestCase):
+    """Tests writing an XmlStream to Python file like objects."""
+    def test_string_io(self):
+        f = io.StringIO()
+        with XmlWrite.XhtmlStream(theFile=f) as xS:
+            _write_XHTML_document(xS)
+        self.assertEqual(f.getvalue(), _expected_XHTML_document())
+
+    def test_bytes_io(self):
+        f = io.BytesIO()
+        with XmlWrite.XhtmlStream(theFile=f) as xS:
+            _write_XHTML_document(xS)
+        self.assertEqual(f.getvalue(), _expected_XHTML_document().encode('utf-8'))
+
+    def test_write_is_batched(self):
+        writer = _CountingWriter()
+        with XmlWrite.XhtmlStream(theFile=writer, flushSize=4096) as xS:
+            _write_XHTML_document(xS)
+        expected = _expected_XHTML_document()
+        self.assertEqual(b''.join(writer.chunks).decode('utf-8'), expected)
+        self.assertTrue(len(writer.chunks) <= len(expected) // 4096 + 1)
+
+    def test_write_raises(self):
+        class BadWriter(object):
+            def write(self, chunk):
+                raise IOError('Write failed')
+        with self.assertRaises(IOError):
+            with XmlWrite.XhtmlStream(theFile=BadWriter()) as xS:
+                pass
+
+    def test_bad_type_raises(self):
+        self.assertRaises(TypeError, XmlWrite.XmlStream, theFile=1.0)
+
+    def test_start_element_from_write_raises(self):
+        # write() is called part way through the attributes of a start tag,
+        # using the stream then must not change those attributes.
+        class ReentrantWriter(_CountingWriter):
+            def write(self, chunk):
+                for _ in range(2):
+                    try:
+                        xS.startElement('Inner', {('z%d' % i) * 50: 'Z' * 5000 for i in range(50)})
+                    except XmlWrite.ExceptionXml as err:
+                        errors.append(err)
+                return super().write(bytes(chunk))
+
+        attrs = {'a%03d' % i: 'v%03d' % i for i in range(100)}
+        expected = '<Root ' + ' '.join('a%03d="v%03d"' % (i, i) for i in range(100)) + ' />'
+
+        def with_element(xS):
+            with XmlWrite.Element(xS, 'Root', attrs):
+                pass
+
+        def start_end(xS):
+            xS.startElement('Root', attrs)
+            xS.endElement('Root')
+
+        for write in (start_end, with_element, lambda xS: xS.writeTree(('Root', attrs))):
+            errors = []
+            writer = ReentrantWriter()
+            xS = XmlWrite.XmlStream(theFile=writer, flushSize=16, mustIndent=False)
+            with xS:
+                write(xS)
+            self.assertTrue(len(errors) > 0)
+            self.assertIn(expected, b''.join(writer.chunks).decode('utf-8'))
+
+
+class TestXmlStreamGetBuffer(unittest.TestCase):
+    """Tests getting the document as bytes or through the buffer protocol."""
+    def test_getvalue_bytes(self):
+        with XmlWrite.XhtmlStream() as xS:
+            _write_XHTML_document(xS)
+        self.assertEqual(xS.getvalue_bytes(), xS.getvalue().encode('utf-8'))
+
+    def test_getbuffer(self):
+        with XmlWrite.XhtmlStream() as xS:
+            _write_XHTML_document(xS)
+        with xS.getbuffer() as view:
+            self.assertEqual(view.tobytes(), xS.getvalue().encode('utf-8'))
+
+    def test_getbuffer_write_raises(self):
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, 'Root'):
+                view = xS.getbuffer()
+                self.assertRaises(XmlWrite.ExceptionXml, xS.characters, u'text')
+                view.release()
+                xS.characters(u'text')
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root>text</Root>
+""")
+
+    def test_getbuffer_with_file_raises(self):
+        with XmlWrite.XmlStream(theFile=io.BytesIO()) as xS:
+            pass
+        self.assertRaises(XmlWrite.ExceptionXml, xS.getbuffer)
+        self.assertRaises(XmlWrite.ExceptionXml, xS.getvalue_bytes)
+
+
+class TestXmlStreamDrain(unittest.TestCase):
+    """Tests draining the output of a stream in chunks."""
+    def test_drain_concatenates(self):
+        chunks = []
+        with XmlWrite.XhtmlStream() as xS:
+            chunks.append(xS.drain())
+            with XmlWrite.Element(xS, 'head'):
+                with XmlWrite.Element(xS, 'title'):
+                    xS.characters(u'Virtual Library')
+            chunks.append(xS.drain())
+            with XmlWrite.Element(xS, 'body'):
+                for i in range(64):
+                    with XmlWrite.Element(xS, 'p', {'class' : 'para_%d' % i}):
+                        xS.characters(u'Moved to ')
+                        with XmlWrite.Element(xS, 'a', {'href' : 'http://example.org/'}):
+                            chunks.append(xS.drain())
+                            xS.characters(u'example.org')
+                        xS.characters(u' since >"2015".')
+                    chunks.append(xS.drain())
+        chunks.append(xS.drain())
+        self.assertEqual(b''.join(chunks).decode('utf-8'), _expected_XHTML_document())
+        self.assertEqual(xS.drain(), b'')
+        self.assertEqual(xS.getvalue(), u'')
+
+    def test_drain_open_element(self):
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, 'Root', {'version' : '12.0'}):
+                with XmlWrite.Element(xS, 'A', {'attr_1' : '1'}):
+                    first = xS.drain()
+                    self.assertTrue(first.endswith(b'<A attr_1="1"'))
+        self.assertEqual(first + xS.drain(), b"""<?xml version='1.0' encoding="utf-8"?>
+<Root version="12.0">
+  <A attr_1="1" />
+</Root>
+""")
+
+    def test_drain_with_file_raises(self):
+        with XmlWrite.XmlStream(theFile=io.BytesIO()) as xS:
+            pass
+        self.assertRaises(XmlWrite.ExceptionXml, xS.drain)
+
+
+class TestElement(unittest.TestCase):
+    """Element holds the name and attributes until __enter__ then only its depth."""
+    def test_element_keeps_stream_alive(self):
+        xS = XmlWrite.XmlStream()
+        xS.__enter__()
+        elem = XmlWrite.Element(xS, 'Root', {'version' : '12.0'})
+        result = xS
+        del xS
+        with elem:
+            pass
+        result.__exit__(None, None, None)
+        self.assertEqual(result.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root version="12.0" />
+""")
+
+    def test_many_elements_reused(self):
+        # More elements alive at once than are kept for reuse, then reused
+        # by a mixture of Element and a subclass.
+        class Sub(XmlWrite.Element):
+            pass
+
+        with XmlWrite.XmlStream(mustIndent=False) as xS:
+            for _ in range(3):
+                elems = [XmlWrite.Element(xS, 'e%d' % i, {'i': str(i)}) for i in range(200)]
+                for elem in elems:
+                    elem.__enter__()
+                for elem in reversed(elems):
+                    elem.__exit__(None, None, None)
+                del elems
+                for i in range(200):
+                    cls = Sub if i % 3 else XmlWrite.Element
+                    with cls(xS, 'f', {'i': str(i)}):
+                        pass
+        value = xS.getvalue()
+        self.assertEqual(value.count('<e199 i="199" />'), 3)
+        self.assertEqual(value.count('<f i="199" />'), 3)
+        self.assertEqual(value.count('<e0 i="0"><e1 i="1">'), 3)
+        self.assertEqual(value.count('</e1></e0>'), 3)
+        self.assertTrue(value.endswith('<f i="199" />\n'))
+
+    def test_close_twice_raises(self):
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, 'Root'):
+                elem = XmlWrite.Element(xS, 'A')
+                elem.__enter__()
+                elem._close()
+                with XmlWrite.Element(xS, 'B'):
+                    self.assertRaises(XmlWrite.ExceptionXmlEndElement, elem._close)
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root>
+  <A />
+  <B />
+</Root>
+""")
+
+    def test_close_not_innermost_raises(self):
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, 'Root') as root:
+                with XmlWrite.Element(xS, 'A'):
+                    self.assertRaises(XmlWrite.ExceptionXmlEndElement, root._close)
+
+    def test_close_before_enter_raises(self):
+        with XmlWrite.XmlStream() as xS:
+            elem = XmlWrite.Element(xS, 'A')
+            self.assertRaises(XmlWrite.ExceptionXmlEndElement, elem._close)
+
+    def test_sort_attributes_off(self):
+        for cls in (XmlWrite.XmlStream, XmlWrite.XmlStreamFast, XmlWrite.XhtmlStream):
+            xS = cls(mustIndent=False)
+            self.assertTrue(xS.sortAttributes)
+            xS.sortAttributes = False
+            self.assertFalse(xS.sortAttributes)
+            with xS:
+                xS.writeTree(('A', {'z': '1', 'b': '2', 'm': '3'}))
+            self.assertIn('<A z="1" b="2" m="3" />', xS.getvalue())
+            xS.reset()
+            self.assertTrue(xS.sortAttributes)
+            with xS:
+                xS.writeTree(('A', {'z': '1', 'b': '2', 'm': '3'}))
+            self.assertIn('<A b="2" m="3" z="1" />', xS.getvalue())
+
+    def test_indent_string(self):
+        xS = XmlWrite.XmlStream()
+        self.assertEqual(xS.indentString, '  ')
+        xS.indentString = '\t'
+        with xS:
+            xS.writeTree(('A', None, [('B', None, [('C', None)])]))
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<A>
+\t<B>
+\t\t<C />
+\t</B>
+</A>
+""")
+        xS.reset()
+        self.assertEqual(xS.indentString, '  ')
+        self.assertRaises(ValueError, setattr, xS, 'indentString', '<')
+        self.assertRaises(TypeError, setattr, xS, 'indentString', 4)
+        self.assertEqual(XmlWrite.XmlStreamFast().indentString, '')
+
+
+class TestElementNames(unittest.TestCase):
+    """Element names are interned by the stream."""
+    def test_many_names(self):
+        names = ['e%d' % i for i in range(100)]
+        with XmlWrite.XmlStream(mustIndent=False) as xS:
+            for name in names:
+                xS.startElement(name, {})
+            for name in reversed(names):
+                xS.endElement(name)
+            for name in names:
+                with XmlWrite.Element(xS, name):
+                    pass
+        # Top level elements are always on a new line.
+        expected = """<?xml version='1.0' encoding="utf-8"?>\n""" \
+            + ''.join('<%s>' % n for n in names[:-1]) + '<e99 />' \
+            + ''.join('</%s>' % n for n in reversed(names[:-1])) \
+            + ''.join('\n<%s />' % n for n in names) + '\n'
+        self.assertEqual(xS.getvalue(), expected)
+
+    def test_end_element_mismatch_names_prefix(self):
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, 'Root'):
+                with XmlWrite.Element(xS, 'AB'):
+                    self.assertRaises(XmlWrite.ExceptionXmlEndElement, xS.endElement, 'A')
+                    self.assertRaises(XmlWrite.ExceptionXmlEndElement, xS.endElement, 'ABC')
+
+
+class TestXmlStreamFast(unittest.TestCase):
+    """XmlStreamFast, XhtmlStreamFast and ElementFast do not indent or check
+    end element names, they still check the element depth."""
+    def test_types(self):
+        self.assertTrue(issubclass(XmlWrite.XhtmlStreamFast, XmlWrite.XmlStreamFast))
+        self.assertFalse(issubclass(XmlWrite.XmlStreamFast, XmlWrite.XmlStream))
+
+    def test_element(self):
+        with XmlWrite.XmlStreamFast() as xS:
+            with XmlWrite.ElementFast(xS, 'Root', {'version' : '12.0'}):
+                with XmlWrite.ElementFast(xS, 'A'):
+                    xS.characters('<&>')
+                with XmlWrite.ElementFast(xS, 'B'):
+                    pass
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>"""
+            """<Root version="12.0"><A>&lt;&amp;&gt;</A><B /></Root>\n""")
+
+    def test_xhtml(self):
+        with XmlWrite.XhtmlStreamFast() as xS:
+            with XmlWrite.ElementFast(xS, 'p'):
+                xS.charactersWithBr('a\nb')
+        self.assertTrue(xS.getvalue().endswith('<p>a<br />b</p></html>\n'))
+
+    def test_end_element_name_not_checked(self):
+        with XmlWrite.XmlStreamFast() as xS:
+            xS.startElement('A', {})
+            xS.endElement('B')
+        self.assertTrue(xS.getvalue().endswith('<A />\n'))
+
+    def test_attributes_escaped_and_sorted(self):
+        with XmlWrite.XmlStreamFast() as xS:
+            with XmlWrite.ElementFast(xS, 'Root', {'b': '1', 'a': '<"'}):
+                xS.characters("a < 'b'")
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>"""
+            """<Root a="&lt;&quot;" b="1">a &lt; 'b'</Root>\n""")
+
+    def test_end_element_without_start_raises(self):
+        xS = XmlWrite.XmlStreamFast()
+        self.assertRaises(XmlWrite.ExceptionXmlEndElement, xS.endElement, 'Root')
+
+    def test_close_twice_raises(self):
+        with XmlWrite.XmlStreamFast() as xS:
+            with XmlWrite.ElementFast(xS, 'Root'):
+                elem = XmlWrite.ElementFast(xS, 'A')
+                elem.__enter__()
+                elem._close()
+                with XmlWrite.ElementFast(xS, 'B'):
+                    self.assertRaises(XmlWrite.ExceptionXmlEndElement, elem._close)
+        self.assertTrue(xS.getvalue().endswith('<Root><A /><B /></Root>\n'))
+
+    def test_element_of_other_stream_raises(self):
+        self.assertRaises(TypeError, XmlWrite.Element, XmlWrite.XmlStreamFast(), 'A')
+        self.assertRaises(TypeError, XmlWrite.ElementFast, XmlWrite.XmlStream(), 'A')
+
+
+class TestXmlStreamReset(unittest.TestCase):
+    """reset() and reuse of the C++ stream of a deleted stream."""
+    def _write(self, xS):
+        with xS:
+            with XmlWrite.Element(xS, 'Root', {'a': '1'}):
+                xS.characters('text')
+
+    def test_reset(self):
+        xS = XmlWrite.XmlStream()
+        self._write(xS)
+        expected = xS.getvalue()
+        xS.reset()
+        self.assertEqual(xS.getvalue(), '')
+        self._write(xS)
+        self.assertEqual(xS.getvalue(), expected)
+
+    def test_reset_open_element(self):
+        xS = XmlWrite.XmlStream()
+        xS.startElement('A', {})
+        xS.startElement('B', {})
+        xS.reset()
+        self._write(xS)
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root a="1">text</Root>
+""")
+
+    def test_reset_with_file_raises(self):
+        with tempfile.TemporaryFile() as f:
+            xS = XmlWrite.XmlStream(theFile=f)
+            self.assertRaises(XmlWrite.ExceptionXml, xS.reset)
+
+    def test_reused_stream_is_fresh(self):
+        # Leave the streams in different states so that reuse is visible.
+        for _ in range(20):
+            xS = XmlWrite.XhtmlStream(mustIndent=False)
+            xS.startElement('A', {})
+            xS.characters('text')
+            del xS
+        for _ in range(20):
+            xS = XmlWrite.XhtmlStream()
+            with xS:
+                with XmlWrite.Element(xS, 'p'):
+                    with XmlWrite.Element(xS, 'br'):
+                        pass
+            self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<!DOCTYPE html PUBLIC "-//W3C//DTD XHTML 1.0 Strict//EN" "http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd">
+<html lang="en" xml:lang="en" xmlns="http://www.w3.org/1999/xhtml">
+  <p>
+    <br />
+  </p>
+</html>
+""")
+
+    def test_init_again(self):
+        xS = XmlWrite.XmlStream()
+        elem = XmlWrite.Element(xS, 'A')
+        xS.__init__(mustIndent=False)
+        self._write(xS)
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root a="1">text</Root>
+""")
+
+
+class TestXmlStreamSizeHint(unittest.TestCase):
+    """sizeHint and profile reserve memory but do not change the output."""
+    def _write(self, xS):
+        with xS:
+            with XmlWrite.Element(xS, 'Root', {'a': '1'}):
+                xS.characters('text' * 100)
+        return xS.getvalue()
+
+    def test_size_hint(self):
+        self.assertEqual(self._write(XmlWrite.XmlStream(sizeHint=1024 * 1024)),
+                         self._write(XmlWrite.XmlStream()))
+
+    def test_size_hint_negative_raises(self):
+        self.assertRaises((ValueError, TypeError), XmlWrite.XmlStream, sizeHint=-1)
+
+    def test_profile(self):
+        expected = self._write(XmlWrite.XmlStream())
+        for _ in range(3):
+            self.assertEqual(self._write(XmlWrite.XmlStream(profile='TestXmlStreamSizeHint')),
+                             expected)
+
+    def test_profile_with_file(self):
+        with tempfile.TemporaryFile() as f:
+            with XmlWrite.XmlStream(theFile=f, profile='TestXmlStreamSizeHint') as xS:
+                xS.characters('text')
+
+
+class TestXmlStreamChunks(unittest.TestCase):
+    """A large in memory document is held in chunks."""
+    def _write(self, xS):
+        with xS:
+            with XmlWrite.Element(xS, 'Root'):
+                for i in range(20000):
+                    with XmlWrite.Element(xS, 'p', {'i': str(i)}):
+                        xS.characters('text ' * 20)
+
+    def _expected(self):
+        return '\n'.join(
+            ["""<?xml version='1.0' encoding="utf-8"?>""", '<Root>']
+            + ['  <p i="%d">%s</p>' % (i, 'text ' * 20) for i in range(20000)]
+            + ['</Root>', '']
+        )
+
+    def test_getvalue(self):
+        xS = XmlWrite.XmlStream()
+        self._write(xS)
+        expected = self._expected()
+        self.assertEqual(xS.getvalue(), expected)
+        self.assertEqual(xS.getvalue_bytes(), expected.encode('utf-8'))
+        self.assertEqual(bytes(xS.getbuffer()), expected.encode('utf-8'))
+        self.assertEqual(xS.getvalue(), expected)
+
+    def test_drain(self):
+        xS = XmlWrite.XmlStream()
+        self._write(xS)
+        self.assertEqual(xS.drain(), self._expected().encode('utf-8'))
+        self.assertEqual(xS.drain(), b'')
+
+    def test_write_to(self):
+        xS = XmlWrite.XmlStream()
+        self._write(xS)
+        with tempfile.TemporaryFile() as f:
+            xS.writeTo(f)
+            f.seek(0)
+            self.assertEqual(f.read(), self._expected().encode('utf-8'))
+
+    def test_write_to_with_file_raises(self):
+        with tempfile.TemporaryFile() as f:
+            xS = XmlWrite.XmlStream(theFile=f)
+            self.assertRaises(XmlWrite.ExceptionXml, xS.writeTo, f)
+
+
+class TestXmlStreamBackground(unittest.TestCase):
+    """background=True writes the file on a thread."""
+    def _write(self, xS):
+        with xS:
+            with XmlWrite.Element(xS, 'Root'):
+                for i in range(5000):
+                    with XmlWrite.Element(xS, 'p', {'i': str(i)}):
+                        xS.characters('text ' * 20)
+
+    def test_background_path(self):
+        expected = XmlWrite.XmlStream()
+        self._write(expected)
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, 'out.xml')
+            self._write(XmlWrite.XmlStream(theFile=path, flushSize=1024, background=True))
+            with open(path) as f:
+                self.assertEqual(f.read(), expected.getvalue())
+
+    def test_background_fd(self):
+        expected = XmlWrite.XmlStream()
+        self._write(expected)
+        with tempfile.TemporaryFile() as f:
+            self._write(XmlWrite.XmlStream(theFile=f.fileno(), background=True))
+            f.seek(0)
+            self.assertEqual(f.read(), expected.getvalue_bytes())
+
+    def test_background_pipe_read_by_thread(self):
+        expected = XmlWrite.XmlStream()
+        self._write(expected)
+
+        def write(fd):
+            self._write(XmlWrite.XmlStream(theFile=fd, flushSize=1024, background=True))
+
+        self.assertEqual(_write_to_pipe_read_by_thread(write), expected.getvalue_bytes())
+
+    def test_background_pipe_read_by_thread_dealloc(self):
+        # The stream is not closed, deallocating it waits for the thread to
+        # write what has been flushed.
+        def write(fd):
+            xS = XmlWrite.XmlStream(theFile=fd, flushSize=1024, background=True)
+            xS.__enter__()
+            xS.characters('text ' * 200000)
+            del xS
+
+        self.assertTrue(_write_to_pipe_read_by_thread(write).endswith(b'text '))
+
+    def test_background_write_raises(self):
+        read_fd, write_fd = os.pipe()
+        os.close(read_fd)
+        xS = XmlWrite.XmlStream(theFile=write_fd, flushSize=16, background=True)
+        try:
+            with self.assertRaises(XmlWrite.ExceptionXml):
+                self._write(xS)
+        finally:
+            os.close(write_fd)
+
+    def test_background_file_object_raises(self):
+        self.assertRaises(ValueError, XmlWrite.XmlStream,
+                          theFile=io.BytesIO(), background=True)
+
+    def test_background_no_file_raises(self):
+        self.assertRaises(ValueError, XmlWrite.XmlStream, background=True)
+
+
+class TestXmlStreamCompression(unittest.TestCase):
+    """compression='gzip' or 'zlib' compresses the output as it is written."""
+    def _write(self, xS):
+        with xS:
+            with XmlWrite.Element(xS, 'Root'):
+                for i in range(5000):
+                    with XmlWrite.Element(xS, 'p', {'i': str(i)}):
+                        xS.characters('text ' * 20)
+
+    def _expected(self):
+        expected = XmlWrite.XmlStream()
+        self._write(expected)
+        return expected.getvalue_bytes()
+
+    def test_gzip_path(self):
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, 'out.xml.gz')
+            self._write(XmlWrite.XmlStream(theFile=path, compression='gzip'))
+            with gzip.open(path) as f:
+                self.assertEqual(f.read(), self._expected())
+
+    def test_zlib_file_object(self):
+        f = io.BytesIO()
+        self._write(XmlWrite.XmlStream(theFile=f, flushSize=1024, compression='zlib'))
+        self.assertEqual(zlib.decompress(f.getvalue()), self._expected())
+
+    def test_sync_size(self):
+        # Everything written so far can be decompressed before close.
+        f = io.BytesIO()
+        xS = XmlWrite.XmlStream(theFile=f, flushSize=1024, compression='zlib',
+                                compressionSyncSize=4096)
+        with xS:
+            with XmlWrite.Element(xS, 'Root'):
+                for i in range(1000):
+                    with XmlWrite.Element(xS, 'p', {'i': str(i)}):
+                        xS.characters('text ' * 20)
+                partial = zlib.decompressobj().decompress(f.getvalue())
+                self.assertTrue(len(partial) > 64 * 1024)
+                self.assertTrue(self._expected().startswith(partial))
+
+    def test_level(self):
+        sizes = []
+        for level in (0, 9):
+            f = io.BytesIO()
+            self._write(XmlWrite.XmlStream(theFile=f, compression='gzip',
+                                           compressionLevel=level))
+            self.assertEqual(gzip.decompress(f.getvalue()), self._expected())
+            sizes.append(len(f.getvalue()))
+        self.assertTrue(sizes[1] < sizes[0] // 10)
+
+    def test_background_gzip(self):
+        with tempfile.TemporaryFile() as f:
+            self._write(XmlWrite.XmlStream(theFile=f.fileno(), flushSize=1024,
+                                           background=True, compression='gzip'))
+            f.seek(0)
+            self.assertEqual(gzip.decompress(f.read()), self._expected())
+
+    def test_bad_level_raises(self):
+        with self.assertRaises(XmlWrite.ExceptionXml):
+            XmlWrite.XmlStream(theFile=io.BytesIO(), compression='gzip',
+                               compressionLevel=10)
+
+    def test_threads_gzip(self):
+        for threads in (0, 2, 4):
+            f = io.BytesIO()
+            self._write(XmlWrite.XmlStream(theFile=f, compression='gzip',
+                                           compressionThreads=threads))
+            self.assertEqual(gzip.decompress(f.getvalue()), self._expected())
+
+    def test_threads_zlib(self):
+        f = io.BytesIO()
+        self._write(XmlWrite.XmlStream(theFile=f, compression='zlib',
+                                       compressionThreads=3))
+        self.assertEqual(zlib.decompress(f.getvalue()), self._expected())
+
+    def test_threads_small_blocks(self):
+        # Blocks smaller than the 32kB dictionary and a document that is
+        # not a whole number of blocks.
+        f = io.BytesIO()
+        self._write(XmlWrite.XmlStream(theFile=f, compression='gzip',
+                                       compressionThreads=2,
+                                       compressionBlockSize=1000))
+        self.assertEqual(gzip.decompress(f.getvalue()), self._expected())
+
+    def test_threads_empty(self):
+        f = io.BytesIO()
+        with XmlWrite.XmlStream(theFile=f, compression='gzip', compressionThreads=2):
+            pass
+        self.assertEqual(gzip.decompress(f.getvalue()),
+                         b"<?xml version='1.0' encoding=\"utf-8\"?>\n")
+
+    def test_threads_background(self):
+        with tempfile.TemporaryFile() as f:
+            self._write(XmlWrite.XmlStream(theFile=f.fileno(), background=True,
+                                           compression='gzip', compressionThreads=2))
+            f.seek(0)
+            self.assertEqual(gzip.decompress(f.read()), self._expected())
+
+    def test_block_size_one_thread_raises(self):
+        self.assertRaises(ValueError, XmlWrite.XmlStream,
+                          theFile=io.BytesIO(), compression='gzip',
+                          compressionBlockSize=1000)
+
+    def test_sync_size_threads_raises(self):
+        self.assertRaises(ValueError, XmlWrite.XmlStream,
+                          theFile=io.BytesIO(), compression='gzip',
+                          compressionThreads=2, compressionSyncSize=1000)
+
+    def test_threads_negative_raises(self):
+        self.assertRaises((ValueError, TypeError), XmlWrite.XmlStream,
+                          theFile=io.BytesIO(), compression='gzip',
+                          compressionThreads=-1)
+
+    def test_bad_compression_raises(self):
+        self.assertRaises(ValueError, XmlWrite.XmlStream,
+                          theFile=io.BytesIO(), compression='bzip2')
+
+    def test_compression_no_file_raises(self):
+        self.assertRaises(ValueError, XmlWrite.XmlStream, compression='gzip')
+
+
+class TestXmlStreamUnicode(unittest.TestCase):
+    """str of any kind is written as UTF-8."""
+    def test_all_kinds(self):
+        for text in (u'latin é', u'bmp 中文', u'astral \U0001f600'):
+            with XmlWrite.XmlStream() as xS:
+                with XmlWrite.Element(xS, 'p', {'a': text}):
+                    xS.characters(text)
+            self.assertEqual(xS.getvalue_bytes().decode('utf-8'),
+                             u"""<?xml version='1.0' encoding="utf-8"?>\n<p a="%s">%s</p>\n"""
+                             % (text, text))
+
+    def test_lone_surrogate_raises(self):
+        xS = XmlWrite.XmlStream()
+        self.assertRaises((ValueError, TypeError), xS.characters, u'\ud800')
+
+
+class TestArguments(unittest.TestCase):
+    """Arguments by position and keyword to the per element methods."""
+    def test_element_keywords(self):
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, theName='Root', theAttrs={'a': '1'}):
+                with XmlWrite.Element(theXmlStream=xS, theName='A'):
+                    xS.comment('c', newLine=True)
+                    xS.comment(theS='d')
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<Root a="1">
+  <A>
+    <!--c--><!--d-->
+  </A>
+</Root>
+""")
+
+    def test_element_missing_raises(self):
+        xS = XmlWrite.XmlStream()
+        self.assertRaises(TypeError, XmlWrite.Element, xS)
+        self.assertRaises(TypeError, XmlWrite.Element, xS, theAttrs={})
+
+    def test_element_too_many_raises(self):
+        xS = XmlWrite.XmlStream()
+        self.assertRaises(TypeError, XmlWrite.Element, xS, 'A', {}, 1)
+
+    def test_element_unknown_keyword_raises(self):
+        xS = XmlWrite.XmlStream()
+        self.assertRaises(TypeError, XmlWrite.Element, xS, 'A', attrs={})
+
+    def test_element_repeated_raises(self):
+        xS = XmlWrite.XmlStream()
+        self.assertRaises(TypeError, XmlWrite.Element, xS, 'A', theName='B')
+
+    def test_element_subclass(self):
+        class Para(XmlWrite.Element):
+            def __init__(self, xS, text):
+                super().__init__(xS, 'p', {'class': 'x'})
+                self.text = text
+
+        with XmlWrite.XmlStream() as xS:
+            with Para(xS, 'hi') as p:
+                xS.characters(p.text)
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<p class="x">hi</p>
+""")
+
+    def test_comment_missing_raises(self):
+        xS = XmlWrite.XmlStream()
+        self.assertRaises(TypeError, xS.comment)
+        self.assertRaises(TypeError, xS.comment, newLine=True)
+
+
+class TestXmlStreamWriteTree(unittest.TestCase):
+
+    def test_deep_raises_recursion_error(self):
+        node = ('e', None)
+        for _ in range(100000):
+            node = ('e', None, [node])
+        with XmlWrite.XmlStream() as xS:
+            with XmlWrite.Element(xS, 'Root'):
+                self.assertRaises(RecursionError, xS.writeTree, node)
+        self.assertTrue(xS.getvalue().endswith('</e>\n</Root>\n'))
+
+    def test_bad_attrs_raises(self):
+        with XmlWrite.XmlStream() as xS:
+            self.assertRaises(TypeError, xS.writeTree, ('A', ['a', '1']))
+            xS.writeTree(('A', None))
+        self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
+<A />
+""")
+
+
+class TestCommandBufferExecute(unittest.TestCase):
+    """A CommandBuffer can not be changed while a stream executes it."""
+    def test_change_from_write_raises(self):
+        errors = []
+
+        class ChangingWriter(_CountingWriter):
+            changing = False
+
+            def write(self, chunk):
+                if self.changing:
+                    for change in (lambda: buffer.start('X'), lambda: buffer.text('x'),
+                                   buffer.end, buffer.clear):
+                        try:
+                            change()
+                        except XmlWrite.ExceptionXml as err:
+                            errors.append(err)
+                return super().write(bytes(chunk))
+
+        buffer = XmlWrite.CommandBuffer()
+        for i in range(100):
+            buffer.start('p', {'i': str(i)})
+            buffer.text('text %d' % i)
+            buffer.end()
+        writer = ChangingWriter()
+        with XmlWrite.XmlStream(theFile=writer, flushSize=16, mustIndent=False) as xS:
+            with XmlWrite.Element(xS, 'Root'):
+                writer.changing = True
+                xS.execute(buffer)
+                writer.changing = False
+        self.assertTrue(len(errors) > 0)
+        self.assertEqual(len(errors) % 4, 0)
+        self.assertEqual(len(buffer), 300)
+        self.assertIn(''.join('<p i="%d">text %d</p>' % (i, i) for i in range(100)),
+                      b''.join(writer.chunks).decode('utf-8'))
+        # Once executed it can be changed again.
+        buffer.clear()
+        self.assertEqual(len(buffer), 0)
@@ -370,7 +370,7 @@ class TestSVGWriter(unittest.TestCase):
         self.assertEqual(xS.getvalue(), """<?xml version='1.0' encoding="utf-8"?>
 <!DOCTYPE svg PUBLIC "-//W3C//DTD SVG 1.1//EN" "http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd">
 <svg height="4.00cm" version="1.1" viewBox="0 0 1000 300" width="12.00cm" xmlns="http://www.w3.org/2000/svg">
-  <desc>Example text01 - &apos;Hello, out there&apos; in blue</desc>
+  <desc>Example text01 - 'Hello, out there' in blue</desc>
   <text fill="blue" font-family="Verdans" font-size="55" x="250px" y="150px">Hello, out there</text>
   <rect fill="none" height="298px" stroke="blue" stroke-width="2" width="998px" x="1px" y="1px" />
 </svg>
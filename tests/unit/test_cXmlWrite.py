@@ -11,5 +11,9 @@ with open(os.path.join(os.path.dirname(__file__), '_test_XmlWrite.py')) as f:
     code = compile(f.read(), __file__, 'exec')
     exec(code)
 
+with open(os.path.join(os.path.dirname(__file__), '_test_XmlWriteCpp.py')) as f:
+    code = compile(f.read(), __file__, 'exec')
+    exec(code)
+
 if __name__ == "__main__":
     pytest.main()
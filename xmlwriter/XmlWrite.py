@@ -154,6 +154,18 @@ class XmlStream(object):
                   ord("'")  : u'&apos;', 
                   ord('"')  : u'&quot;',
                   }
+    # Character content only needs < & and > (for readability).
+    ENTITY_MAP_TEXT = {
+                  ord('<')  : u'&lt;',
+                  ord('>')  : u'&gt;',
+                  ord('&')  : u'&amp;',
+                  }
+    # Attribute values are written in double quotes.
+    ENTITY_MAP_ATTRIBUTE = {
+                  ord('<')  : u'&lt;',
+                  ord('&')  : u'&amp;',
+                  ord('"')  : u'&quot;',
+                  }
     def __init__(self, theEnc='utf-8', theDtdLocal=None, theId=0, mustIndent=True):
         """Initialise with an encoding.
         
@@ -235,7 +247,7 @@ class XmlStream(object):
         self._file.write(u'<%s' % name)
         kS = sorted(attrs.keys())
         for k in kS:
-            self._file.write(u' %s="%s"' % (k, self._encode(attrs[k])))
+            self._file.write(u' %s="%s"' % (k, self._encode(attrs[k], self.ENTITY_MAP_ATTRIBUTE)))
         self._inElem = True
         self._canIndentStk.append(self._mustIndent)
         self._elemStk.append(name)
@@ -248,7 +260,7 @@ class XmlStream(object):
         :returns: ``NoneType``
         """
         self._closeElemIfOpen()
-        encStr = self._encode(theString)
+        encStr = self._encode(theString, self.ENTITY_MAP_TEXT)
         self._file.write(encStr)
         # mixed content - don't indent
         self._flipIndent(False)
@@ -277,14 +289,14 @@ class XmlStream(object):
         self._closeElemIfOpen()
         if newLine:
             self._indent()
-        self._file.write('<!--%s-->' % self._encode(theS))
+        self._file.write('<!--%s-->' % self._encodeComment(theS))
         # mixed content - don't indent
         #self._flipIndent(False)
 
     def pI(self, theS):
         """Writes a Processing Instruction to the output stream."""
         self._closeElemIfOpen()
-        self._file.write('<?%s?>' % self._encode(theS))
+        self._file.write('<?%s?>' % self._encode(theS, self.ENTITY_MAP_TEXT))
         self._flipIndent(False)
 
     def endElement(self, name):
@@ -382,6 +394,71 @@ class XmlStream(object):
         self.writeCDATA(u'\n'.join(theLines))
         self.endElement('style')
     
+    def writeTree(self, theNode):
+        """Writes a subtree in one call. A node is either a string, written
+        with ``characters()``, or a tuple or list of
+        ``(name, attrs[, children])`` where attrs is a dict or None and
+        children is a string or a list or tuple of nodes.
+
+        Example:
+
+        .. code-block:: python
+
+            stream.writeTree(('ul', {'class': 'x'}, [('li', None, 'One'), ('li', None, 'Two')]))
+
+        :param theNode: The root node.
+
+        :returns: ``NoneType``
+        """
+        if isinstance(theNode, str):
+            self.characters(theNode)
+            return
+        if not isinstance(theNode, (tuple, list)) or len(theNode) not in (2, 3):
+            raise TypeError(
+                'A node to writeTree() must be a str or a tuple or list of (name, attrs[, children]) not %r' % (theNode,)
+            )
+        name = theNode[0]
+        self.startElement(name, theNode[1] or {})
+        try:
+            if len(theNode) == 3:
+                children = theNode[2]
+                if isinstance(children, str):
+                    self.characters(children)
+                elif isinstance(children, (tuple, list)):
+                    for child in children:
+                        self.writeTree(child)
+                else:
+                    raise TypeError(
+                        'The children in writeTree() must be a str, tuple or list not %r' % (children,)
+                    )
+        finally:
+            self.endElement(name)
+    
+    def execute(self, theBuffer):
+        """Writes the operations recorded in a :py:class:`CommandBuffer`.
+        If this raises the operations before the failing one have been
+        written.
+
+        :param theBuffer: The CommandBuffer.
+
+        :returns: ``NoneType``
+        """
+        if not isinstance(theBuffer, CommandBuffer):
+            raise TypeError(
+                'Argument to execute() must be a CommandBuffer not %r' % type(theBuffer).__name__
+            )
+        for op in theBuffer._ops:
+            if op[0] == CommandBuffer.START:
+                self.startElement(op[1], op[2])
+            elif op[0] == CommandBuffer.TEXT:
+                self.characters(op[1])
+            else:
+                if len(self._elemStk) == 0:
+                    raise ExceptionXmlEndElement(
+                        'Can not end an element when there are no open elements'
+                    )
+                self.endElement(self._elemStk[-1])
+    
     def _indent(self, offset=0):
         """Write out the indent string.
 
@@ -402,25 +479,43 @@ class XmlStream(object):
             self._file.write(u'>')
             self._inElem = False
 
-    def _encode(self, theStr):
+    def _encode(self, theStr, theEntityMap=None):
         """"Apply the XML encoding such as ``'<'`` to ``'&lt;'``
 
         :param theStr: String to encode.
 
+        :param theEntityMap: The entities to apply, default is all of ``ENTITY_MAP``.
+
         :returns: ``str`` -- Encoded string.
         """
+        if theEntityMap is None:
+            theEntityMap = self.ENTITY_MAP
         if sys.version_info.major == 2:
             # Python 2 clunkiness
             result = []
             for c in theStr:
                 try:
-                    result.append(self.ENTITY_MAP[ord(c)])
+                    result.append(theEntityMap[ord(c)])
                 except KeyError:
                     result.append(c)
             return u''.join(result)
         else:
             assert sys.version_info.major == 3
-            return theStr.translate(self.ENTITY_MAP)
+            return theStr.translate(theEntityMap)
+
+    def _encodeComment(self, theS):
+        """Entities are not recognised in comments but ``'--'`` is not allowed
+        and the comment must not end with ``'-'`` so these are separated with a space.
+
+        :param theS: The comment.
+
+        :returns: ``str`` -- Encoded string.
+        """
+        while '--' in theS:
+            theS = theS.replace('--', '- -')
+        if theS.endswith('-'):
+            theS += ' '
+        return theS
     
     def __enter__(self):
         """Context manager support.
@@ -540,3 +635,76 @@ class Element(object):
         # Close element on the stream
         self._stream.endElement(self._name)
         #return True
+
+##################################
+# Section: Command buffer for any writer.
+##################################
+class CommandBuffer(object):
+    """A batch of startElement(), characters() and endElement() calls
+    recorded to be written later by :py:meth:`XmlStream.execute`.
+    
+    end() ends the innermost open element of the stream when the buffer is
+    executed, this need not have been started by the same buffer so a
+    document can be written in several batches.
+    """
+    START = 0
+    TEXT = 1
+    END = 2
+    def __init__(self):
+        """Constructor.
+
+        :returns: ``NoneType``
+        """
+        self._ops = []
+
+    def start(self, name, attrs=None):
+        """Record a startElement(name, attrs).
+
+        :param name: Element name.
+
+        :param attrs: Element attributes, a dict or None.
+
+        :returns: ``NoneType``
+        """
+        if attrs is not None and not isinstance(attrs, dict):
+            raise TypeError(
+                'Argument "attrs" to start() must be dict or None not %r' % type(attrs).__name__
+            )
+        # A copy as later changes to the dict must not affect the buffer.
+        self._ops.append((self.START, name, dict(attrs or {})))
+
+    def text(self, theString):
+        """Record a characters(theString). Consecutive text is joined into
+        one operation.
+
+        :param theString: The text.
+
+        :returns: ``NoneType``
+        """
+        if not isinstance(theString, str):
+            raise TypeError('Argument to text() must be str not %r' % type(theString).__name__)
+        if self._ops and self._ops[-1][0] == self.TEXT:
+            self._ops[-1] = (self.TEXT, self._ops[-1][1] + theString)
+        else:
+            self._ops.append((self.TEXT, theString))
+
+    def end(self):
+        """Record the end of the innermost open element.
+
+        :returns: ``NoneType``
+        """
+        self._ops.append((self.END,))
+
+    def clear(self):
+        """Discard the recorded operations so that the buffer can be reused.
+
+        :returns: ``NoneType``
+        """
+        self._ops = []
+
+    def __len__(self):
+        """The number of recorded operations.
+
+        :returns: ``int``
+        """
+        return len(self._ops)
@@ -0,0 +1,100 @@
+//
+//  XmlAttrs.cpp
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#include "XmlAttrs.h"
+
+const size_t XmlAttrs::INLINE_SIZE;
+
+XmlAttrs::XmlAttrs(std::initializer_list<tPair> theAttrs) : _size(0), _sorted(true) {
+    size_t bytes = 0;
+    for (const auto &attr: theAttrs) {
+        bytes += attr.first.size() + attr.second.size();
+    }
+    reserve(theAttrs.size(), bytes);
+    for (const auto &attr: theAttrs) {
+        set(attr.first, attr.second);
+    }
+}
+
+XmlAttrs::XmlAttrs(const std::map<std::string, std::string> &theMap) : _size(0), _sorted(true) {
+    size_t bytes = 0;
+    for (const auto &attr: theMap) {
+        bytes += attr.first.size() + attr.second.size();
+    }
+    reserve(theMap.size(), bytes);
+    for (const auto &attr: theMap) {
+        add(attr.first, attr.second);
+    }
+}
+
+void XmlAttrs::add(XmlStringView name, XmlStringView value) {
+    if (_size && _sorted && !(this->name(_size - 1) < name)) {
+        _sorted = false;
+    }
+    tEntry entry;
+    entry.name_offset = _bytes.size();
+    entry.name_size = name.size();
+    _bytes.append(name.data(), name.size());
+    entry.value_offset = _bytes.size();
+    entry.value_size = value.size();
+    _bytes.append(value.data(), value.size());
+    if (_size < INLINE_SIZE) {
+        _inline[_size] = entry;
+    } else {
+        _overflow.push_back(entry);
+    }
+    ++_size;
+}
+
+void XmlAttrs::set(XmlStringView name, XmlStringView value) {
+    size_t index = find(name);
+    if (index == _size) {
+        add(name, value);
+    } else {
+        // The old value bytes are left unused.
+        tEntry &entry = _entry(index);
+        entry.value_offset = _bytes.size();
+        entry.value_size = value.size();
+        _bytes.append(value.data(), value.size());
+    }
+}
+
+size_t XmlAttrs::find(XmlStringView name) const {
+    for (size_t i = 0; i < _size; ++i) {
+        if (this->name(i) == name) {
+            return i;
+        }
+    }
+    return _size;
+}
+
+void XmlAttrs::reserve(size_t count, size_t bytes) {
+    _bytes.reserve(bytes);
+    if (count > INLINE_SIZE) {
+        _overflow.reserve(count - INLINE_SIZE);
+    }
+}
+
+void XmlAttrs::clear() {
+    _bytes.clear();
+    _overflow.clear();
+    _size = 0;
+    _sorted = true;
+}
+
+void XmlAttrs::_sortedOrder(size_t *order) const {
+    // Insertion sort, there are rarely more than a handful of attributes.
+    for (size_t i = 0; i < _size; ++i) {
+        size_t j = i;
+        XmlStringView key = name(i);
+        while (j > 0 && key < name(order[j - 1])) {
+            order[j] = order[j - 1];
+            --j;
+        }
+        order[j] = i;
+    }
+}
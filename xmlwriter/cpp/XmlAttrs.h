@@ -0,0 +1,141 @@
+//
+//  XmlAttrs.h
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#ifndef XmlAttrs_h
+#define XmlAttrs_h
+
+#include <cstring>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Attributes of an element.
+ *
+ * This replaces a std::map<std::string, std::string> which cost a tree node
+ * and two strings for every attribute. XmlAttrs holds all the name and
+ * value bytes in one contiguous string and the offsets of the first
+ * INLINE_SIZE attributes in the object itself so a typical element needs at
+ * most one allocation, or none if the bytes fit the small string buffer.
+ *
+ * Attributes are kept in the order they were added. XmlStream writes them
+ * sorted by name by default, as the std::map did and as XmlWrite.py does,
+ * see XmlStream::sortAttributes().
+ */
+
+// A non-owning reference to a sequence of chars, C++11 has no
+// std::string_view. The referenced memory must outlive the view.
+class XmlStringView {
+public:
+    XmlStringView() : _data(""), _size(0) {}
+    XmlStringView(const char *s) : _data(s), _size(std::strlen(s)) {}
+    XmlStringView(const char *s, size_t n) : _data(s), _size(n) {}
+    XmlStringView(const std::string &s) : _data(s.data()), _size(s.size()) {}
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    std::string str() const { return std::string(_data, _size); }
+    // Byte wise comparison, the same as std::string::compare().
+    int compare(const XmlStringView &other) const {
+        size_t len = _size < other._size ? _size : other._size;
+        int result = len ? std::memcmp(_data, other._data, len) : 0;
+        if (result == 0 && _size != other._size) {
+            result = _size < other._size ? -1 : 1;
+        }
+        return result;
+    }
+    bool operator==(const XmlStringView &other) const {
+        return _size == other._size && std::memcmp(_data, other._data, _size) == 0;
+    }
+    bool operator!=(const XmlStringView &other) const { return !(*this == other); }
+    bool operator<(const XmlStringView &other) const { return compare(other) < 0; }
+private:
+    const char *_data;
+    size_t _size;
+};
+
+class XmlAttrs {
+public:
+    static const size_t INLINE_SIZE = 8;
+    using tPair = std::pair<XmlStringView, XmlStringView>;
+
+    XmlAttrs() : _size(0), _sorted(true) {}
+    // As with a std::map if a name is repeated the last value is used.
+    XmlAttrs(std::initializer_list<tPair> theAttrs);
+    // For compatibility with code that built a std::map.
+    XmlAttrs(const std::map<std::string, std::string> &theMap);
+    // Append an attribute, the caller guarantees that the name is not
+    // already present, for example when converting from a dict.
+    void add(XmlStringView name, XmlStringView value);
+    // Add an attribute or replace the value of an existing one.
+    void set(XmlStringView name, XmlStringView value);
+    // Returns the index of the name or size() if absent.
+    size_t find(XmlStringView name) const;
+    // Reserve space for count attributes and bytes of names and values.
+    void reserve(size_t count, size_t bytes);
+    void clear();
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    // True if the attributes were added in name order.
+    bool isSorted() const { return _sorted; }
+    XmlStringView name(size_t index) const {
+        const tEntry &entry = _entry(index);
+        return XmlStringView(_bytes.data() + entry.name_offset, entry.name_size);
+    }
+    XmlStringView value(size_t index) const {
+        const tEntry &entry = _entry(index);
+        return XmlStringView(_bytes.data() + entry.value_offset, entry.value_size);
+    }
+    // Call fn(name, value) for every attribute, in name order if sorted is
+    // true otherwise in the order they were added.
+    template <typename F>
+    void visit(bool sorted, F fn) const {
+        if (!sorted || _sorted) {
+            for (size_t i = 0; i < _size; ++i) {
+                fn(name(i), value(i));
+            }
+        } else if (_size <= INLINE_SIZE) {
+            size_t order[INLINE_SIZE];
+            _sortedOrder(order);
+            for (size_t i = 0; i < _size; ++i) {
+                fn(name(order[i]), value(order[i]));
+            }
+        } else {
+            std::vector<size_t> order(_size);
+            _sortedOrder(order.data());
+            for (size_t i = 0; i < _size; ++i) {
+                fn(name(order[i]), value(order[i]));
+            }
+        }
+    }
+protected:
+    struct tEntry {
+        size_t name_offset;
+        size_t name_size;
+        size_t value_offset;
+        size_t value_size;
+    };
+    const tEntry &_entry(size_t index) const {
+        return index < INLINE_SIZE ? _inline[index] : _overflow[index - INLINE_SIZE];
+    }
+    tEntry &_entry(size_t index) {
+        return index < INLINE_SIZE ? _inline[index] : _overflow[index - INLINE_SIZE];
+    }
+    // Fill order with the indices of the attributes in name order.
+    void _sortedOrder(size_t *order) const;
+protected:
+    // Names and values, not null terminated.
+    std::string _bytes;
+    tEntry _inline[INLINE_SIZE];
+    std::vector<tEntry> _overflow;
+    size_t _size;
+    bool _sorted;
+};
+
+#endif /* XmlAttrs_h */
@@ -0,0 +1,93 @@
+//
+//  XmlCommandBuffer.cpp
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#include <assert.h>
+
+#include "XmlCommandBuffer.h"
+#include "XmlWrite.h"
+
+void XmlCommandBuffer::start(XmlStringView name, const XmlAttrs &attrs) {
+    start(name);
+    for (size_t i = 0; i < attrs.size(); ++i) {
+        attribute(attrs.name(i), attrs.value(i));
+    }
+}
+
+void XmlCommandBuffer::start(XmlStringView name) {
+    _checkNotExecuting();
+    tOp op;
+    op.code = OP_START;
+    op.name = _names.intern(name);
+    op.begin = _attrs.size();
+    op.size = 0;
+    _ops.push_back(op);
+    _inText = false;
+}
+
+void XmlCommandBuffer::attribute(XmlStringView name, XmlStringView value) {
+    _checkNotExecuting();
+    assert(! _ops.empty() && _ops.back().code == OP_START);
+    tAttr attr;
+    attr.name = _names.intern(name);
+    attr.value_offset = _bytes.size();
+    attr.value_size = value.size();
+    _bytes.append(value.data(), value.size());
+    _attrs.push_back(attr);
+    ++_ops.back().size;
+}
+
+void XmlCommandBuffer::text(XmlStringView theString) {
+    _checkNotExecuting();
+    if (_inText) {
+        // The text is at the end of _bytes.
+        _ops.back().size += theString.size();
+    } else {
+        tOp op;
+        op.code = OP_TEXT;
+        op.name = 0;
+        op.begin = _bytes.size();
+        op.size = theString.size();
+        _ops.push_back(op);
+        _inText = true;
+    }
+    _bytes.append(theString.data(), theString.size());
+}
+
+void XmlCommandBuffer::end() {
+    _checkNotExecuting();
+    tOp op;
+    op.code = OP_END;
+    op.name = 0;
+    op.begin = 0;
+    op.size = 0;
+    _ops.push_back(op);
+    _inText = false;
+}
+
+void XmlCommandBuffer::clear() {
+    _checkNotExecuting();
+    _ops.clear();
+    _attrs.clear();
+    _bytes.clear();
+    _inText = false;
+}
+
+void XmlCommandBuffer::attributes(const tOp &op, XmlAttrs &attrs) const {
+    assert(op.code == OP_START);
+    attrs.clear();
+    for (size_t i = op.begin; i < op.begin + op.size; ++i) {
+        const tAttr &attr = _attrs[i];
+        attrs.add(_names.name(attr.name),
+                  XmlStringView(_bytes.data() + attr.value_offset, attr.value_size));
+    }
+}
+
+void XmlCommandBuffer::_checkNotExecuting() const {
+    if (_executing) {
+        throw ExceptionXml("Can not change a CommandBuffer while it is being executed.");
+    }
+}
@@ -0,0 +1,113 @@
+//
+//  XmlCommandBuffer.h
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#ifndef XmlCommandBuffer_h
+#define XmlCommandBuffer_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "XmlAttrs.h"
+#include "XmlNameTable.h"
+
+/**
+ * A batch of startElement(), characters() and endElement() calls recorded
+ * to be replayed later by XmlStream::execute().
+ *
+ * This is for a producer that can not build the whole tree up front, for
+ * example from Python, recording is an append and the writing is done in
+ * one loop. The operations are held in one vector and all text and
+ * attribute values in one string. Element and attribute names are
+ * interned so a name that is used many times is stored once.
+ *
+ * end() ends the innermost open element of the stream when the buffer is
+ * executed, this need not have been started by the same buffer so a
+ * document can be written in several batches.
+ *
+ * A flush during XmlStream::execute() may release the GIL or call Python
+ * which could change the buffer under the loop, so while it is executed the
+ * methods that change it raise an ExceptionXml.
+ */
+class XmlCommandBuffer {
+public:
+    using tId = XmlNameTable::tId;
+    enum tOpCode : uint8_t {
+        OP_START,
+        OP_TEXT,
+        OP_END,
+    };
+    struct tOp {
+        tOpCode code;
+        // OP_START: the ID of the element name.
+        tId name;
+        // OP_START: the index in _attrs of the first attribute and the count.
+        // OP_TEXT: the offset in _bytes of the text and its size.
+        size_t begin;
+        size_t size;
+    };
+
+    // Record a startElement().
+    void start(XmlStringView name, const XmlAttrs &attrs);
+    // Record a startElement() whose attributes are added by attribute().
+    void start(XmlStringView name);
+    // Add an attribute to the preceding start(). As XmlAttrs::add() the
+    // caller guarantees that the name is not already present.
+    void attribute(XmlStringView name, XmlStringView value);
+    // Record a characters(), consecutive text is joined.
+    void text(XmlStringView theString);
+    // Record an endElement() of the innermost element.
+    void end();
+    // Discard the operations, the memory is kept.
+    void clear();
+    // The number of operations.
+    size_t size() const { return _ops.size(); }
+    bool empty() const { return _ops.empty(); }
+
+    const std::vector<tOp> &ops() const { return _ops; }
+    XmlStringView name(tId id) const { return _names.name(id); }
+    XmlStringView text(const tOp &op) const {
+        return XmlStringView(_bytes.data() + op.begin, op.size);
+    }
+    // Replace the contents of attrs with the attributes of an OP_START.
+    void attributes(const tOp &op, XmlAttrs &attrs) const;
+    // The number of executions in progress.
+    size_t executing() const { return _executing; }
+    // Marks the buffer as being executed for the lifetime of this object.
+    class Executing {
+    public:
+        explicit Executing(const XmlCommandBuffer &theCommands) : _commands(theCommands) {
+            ++_commands._executing;
+        }
+        ~Executing() { --_commands._executing; }
+        Executing(const Executing &) = delete;
+        Executing &operator=(const Executing &) = delete;
+    private:
+        const XmlCommandBuffer &_commands;
+    };
+protected:
+    // Raise an ExceptionXml if the buffer is being executed.
+    void _checkNotExecuting() const;
+protected:
+    struct tAttr {
+        tId name;
+        size_t value_offset;
+        size_t value_size;
+    };
+protected:
+    std::vector<tOp> _ops;
+    std::vector<tAttr> _attrs;
+    // Text and attribute values, not null terminated.
+    std::string _bytes;
+    // Element and attribute names.
+    XmlNameTable _names;
+    // True if the last operation is OP_TEXT that can be extended.
+    bool _inText = false;
+    mutable size_t _executing = 0;
+};
+
+#endif /* XmlCommandBuffer_h */
@@ -0,0 +1,241 @@
+//
+//  XmlEscape.cpp
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#include <atomic>
+#include <cstring>
+
+#include "XmlEscape.h"
+
+// The SIMD kernels are compiled with target attributes so the build does not
+// need -msse2 or -mavx2, each is only selected if the CPU supports it.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define XML_ESCAPE_X86 1
+#include <immintrin.h>
+#else
+#define XML_ESCAPE_X86 0
+#endif
+
+// Bit (1 << context) is set for characters that must be escaped in that
+// context.
+#define ALL (1 << XML_ESCAPE_ALL)
+#define TXT (1 << XML_ESCAPE_TEXT)
+#define ATT (1 << XML_ESCAPE_ATTRIBUTE)
+static const unsigned char ESCAPE_TABLE[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x00
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x10
+    0, 0, ALL | ATT, 0, 0, 0, ALL | TXT | ATT, ALL, // 0x20 " & '
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, ALL | TXT | ATT, 0, ALL | TXT, 0, // 0x30 < >
+    // 0x40 onwards is all zero.
+};
+#undef ALL
+#undef TXT
+#undef ATT
+
+// The characters to search for in each context, the SIMD kernels compare
+// against each one so fewer characters is a faster scan.
+template <XmlEscapeContext C> struct EscapeChars;
+
+template <> struct EscapeChars<XML_ESCAPE_ALL> {
+    static const int count = 5;
+    static const char *chars() { return "<>&'\""; }
+};
+
+template <> struct EscapeChars<XML_ESCAPE_TEXT> {
+    static const int count = 3;
+    static const char *chars() { return "<>&"; }
+};
+
+template <> struct EscapeChars<XML_ESCAPE_ATTRIBUTE> {
+    static const int count = 3;
+    static const char *chars() { return "<&\""; }
+};
+
+template <XmlEscapeContext C>
+static size_t find_scalar(const char *data, size_t len) {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < len; ++i) {
+        if (ESCAPE_TABLE[p[i]] & (1 << C)) {
+            return i;
+        }
+    }
+    return len;
+}
+
+#if XML_ESCAPE_X86
+template <XmlEscapeContext C>
+__attribute__((target("sse2")))
+static size_t find_sse2(const char *data, size_t len) {
+    typedef EscapeChars<C> tChars;
+    __m128i targets[tChars::count];
+    for (int k = 0; k < tChars::count; ++k) {
+        targets[k] = _mm_set1_epi8(tChars::chars()[k]);
+    }
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i hits = _mm_cmpeq_epi8(chunk, targets[0]);
+        for (int k = 1; k < tChars::count; ++k) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, targets[k]));
+        }
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) {
+            return i + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+    }
+    return i + find_scalar<C>(data + i, len - i);
+}
+
+template <XmlEscapeContext C>
+__attribute__((target("avx2")))
+static size_t find_avx2(const char *data, size_t len) {
+    typedef EscapeChars<C> tChars;
+    __m256i targets[tChars::count];
+    for (int k = 0; k < tChars::count; ++k) {
+        targets[k] = _mm256_set1_epi8(tChars::chars()[k]);
+    }
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i hits = _mm256_cmpeq_epi8(chunk, targets[0]);
+        for (int k = 1; k < tChars::count; ++k) {
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, targets[k]));
+        }
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_sse2<C>(data + i, len - i);
+}
+#endif
+
+typedef size_t (*tFindFn)(const char *, size_t);
+
+struct tScanner {
+    const char *name;
+    tFindFn fn;
+};
+
+// The scanners this CPU supports in order of preference, the last is always
+// the scalar one. The name of the selected scanner is found by its function
+// so there is no shared state other than FindDispatch::fn_ptr.
+template <XmlEscapeContext C>
+static size_t supported_scanners(tScanner *scanners) {
+    size_t count = 0;
+#if XML_ESCAPE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scanners[count++] = { "avx2", find_avx2<C> };
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        scanners[count++] = { "sse2", find_sse2<C> };
+    }
+#endif
+    scanners[count++] = { "scalar", find_scalar<C> };
+    return count;
+}
+
+static const size_t MAX_SCANNERS = 3;
+
+template <XmlEscapeContext C>
+static tFindFn select_find() {
+    tScanner scanners[MAX_SCANNERS];
+    supported_scanners<C>(scanners);
+    return scanners[0].fn;
+}
+
+// One dispatcher per context. The function pointer starts as the resolver
+// which replaces itself on first use so there are no static initialisation
+// order issues.
+template <XmlEscapeContext C>
+struct FindDispatch {
+    static size_t resolve(const char *data, size_t len) {
+        tFindFn fn = select_find<C>();
+        fn_ptr.store(fn, std::memory_order_relaxed);
+        return fn(data, len);
+    }
+    static std::atomic<tFindFn> fn_ptr;
+};
+
+template <XmlEscapeContext C>
+std::atomic<tFindFn> FindDispatch<C>::fn_ptr(FindDispatch<C>::resolve);
+
+template <XmlEscapeContext C>
+size_t xml_escape_find(const char *data, size_t len) {
+    return FindDispatch<C>::fn_ptr.load(std::memory_order_relaxed)(data, len);
+}
+
+template size_t xml_escape_find<XML_ESCAPE_ALL>(const char *data, size_t len);
+template size_t xml_escape_find<XML_ESCAPE_TEXT>(const char *data, size_t len);
+template size_t xml_escape_find<XML_ESCAPE_ATTRIBUTE>(const char *data, size_t len);
+
+size_t xml_escape_find(const char *data, size_t len) {
+    return xml_escape_find<XML_ESCAPE_ALL>(data, len);
+}
+
+const char *xml_escape_entity(char c, size_t &entity_len) {
+    switch (c) {
+        case '<':
+            entity_len = 4;
+            return "&lt;";
+        case '>':
+            entity_len = 4;
+            return "&gt;";
+        case '&':
+            entity_len = 5;
+            return "&amp;";
+        case '\'':
+            entity_len = 6;
+            return "&apos;";
+        case '"':
+            entity_len = 6;
+            return "&quot;";
+        default:
+            break;
+    }
+    entity_len = 0;
+    return "";
+}
+
+const char *xml_escape_scanner_name() {
+    xml_escape_find("", 0);
+    tFindFn fn = FindDispatch<XML_ESCAPE_ALL>::fn_ptr.load(std::memory_order_relaxed);
+    tScanner scanners[MAX_SCANNERS];
+    size_t count = supported_scanners<XML_ESCAPE_ALL>(scanners);
+    for (size_t i = 0; i < count; ++i) {
+        if (scanners[i].fn == fn) {
+            return scanners[i].name;
+        }
+    }
+    return "unknown";
+}
+
+size_t xml_escape_scanner_names(const char **names, size_t size) {
+    tScanner scanners[MAX_SCANNERS];
+    size_t count = supported_scanners<XML_ESCAPE_ALL>(scanners);
+    for (size_t i = 0; i < count && i < size; ++i) {
+        names[i] = scanners[i].name;
+    }
+    return count;
+}
+
+template <XmlEscapeContext C>
+size_t xml_escape_find_with(const char *scanner, const char *data, size_t len) {
+    tScanner scanners[MAX_SCANNERS];
+    size_t count = supported_scanners<C>(scanners);
+    for (size_t i = 0; i < count; ++i) {
+        if (std::strcmp(scanners[i].name, scanner) == 0) {
+            return scanners[i].fn(data, len);
+        }
+    }
+    return xml_escape_find<C>(data, len);
+}
+
+template size_t xml_escape_find_with<XML_ESCAPE_ALL>(const char *scanner, const char *data, size_t len);
+template size_t xml_escape_find_with<XML_ESCAPE_TEXT>(const char *scanner, const char *data, size_t len);
+template size_t xml_escape_find_with<XML_ESCAPE_ATTRIBUTE>(const char *scanner, const char *data, size_t len);
@@ -0,0 +1,60 @@
+//
+//  XmlEscape.h
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#ifndef XmlEscape_h
+#define XmlEscape_h
+
+#include <cstddef>
+
+/**
+ * Scanning for the characters that must be replaced by an entity.
+ *
+ * Which characters need escaping depends on where the text is written:
+ *
+ * - XML_ESCAPE_ALL: < > & ' " this is safe anywhere and is what
+ *   XmlStream::_encode() has always done.
+ * - XML_ESCAPE_TEXT: < > & for character content. The '>' is only strictly
+ *   needed after "]]" but is always escaped for readability.
+ * - XML_ESCAPE_ATTRIBUTE: < & " for attribute values in double quotes.
+ *
+ * The context is a template argument so each has its own scanner.
+ * Most text needs no escaping at all so the scanner is the hot path of
+ * XmlStream::_encode(). On x86 this uses SSE2 or AVX2, chosen at runtime by
+ * the CPU, to test 16 or 32 bytes at a time. Other platforms use a lookup
+ * table one byte at a time.
+ */
+
+enum XmlEscapeContext {
+    XML_ESCAPE_ALL,
+    XML_ESCAPE_TEXT,
+    XML_ESCAPE_ATTRIBUTE,
+};
+
+// Returns the index of the first character in data that must be escaped in
+// context C or len if there is none.
+template <XmlEscapeContext C>
+size_t xml_escape_find(const char *data, size_t len);
+
+// As above for XML_ESCAPE_ALL.
+size_t xml_escape_find(const char *data, size_t len);
+
+// Returns the entity for the character c that must be escaped and sets
+// entity_len to its length. c must be one of the characters above.
+const char *xml_escape_entity(char c, size_t &entity_len);
+
+// The name of the scanner in use, for example "avx2", "sse2" or "scalar".
+const char *xml_escape_scanner_name();
+
+// For testing each scanner. Sets names[0...] to the names of the scanners
+// this CPU supports, at most size of them, and returns how many there are.
+size_t xml_escape_scanner_names(const char **names, size_t size);
+// As xml_escape_find() with the named scanner, or the one in use if this
+// CPU does not support it.
+template <XmlEscapeContext C>
+size_t xml_escape_find_with(const char *scanner, const char *data, size_t len);
+
+#endif /* XmlEscape_h */
@@ -0,0 +1,68 @@
+//
+//  XmlNameTable.cpp
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#include "XmlNameTable.h"
+
+// FNV-1a
+size_t XmlNameTable::_hash(XmlStringView name) {
+    uint64_t hash = 14695981039346656037ULL;
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(name.data());
+    for (size_t i = 0; i < name.size(); ++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return static_cast<size_t>(hash);
+}
+
+XmlNameTable::tId XmlNameTable::intern(XmlStringView name) {
+    if (_slots.empty()) {
+        _grow();
+    }
+    size_t hash = _hash(name);
+    size_t index = hash & _mask;
+    while (_slots[index]) {
+        tId id = _slots[index] - 1;
+        if (_hashes[id] == hash && this->name(id) == name) {
+            return id;
+        }
+        index = (index + 1) & _mask;
+    }
+    tId id = static_cast<tId>(_endTags.size());
+    std::string tag;
+    tag.reserve(name.size() + 3);
+    tag.append("</", 2);
+    tag.append(name.data(), name.size());
+    tag.push_back('>');
+    _endTags.push_back(std::move(tag));
+    _hashes.push_back(hash);
+    _slots[index] = id + 1;
+    // Keep the load factor at most 1/2.
+    if (_endTags.size() * 2 > _slots.size()) {
+        _grow();
+    }
+    return id;
+}
+
+void XmlNameTable::_grow() {
+    size_t capacity = _slots.empty() ? 32 : _slots.size() * 2;
+    _slots.assign(capacity, 0);
+    _mask = capacity - 1;
+    for (tId id = 0; id < _endTags.size(); ++id) {
+        size_t index = _hashes[id] & _mask;
+        while (_slots[index]) {
+            index = (index + 1) & _mask;
+        }
+        _slots[index] = id + 1;
+    }
+}
+
+void XmlNameTable::clear() {
+    std::vector<std::string>().swap(_endTags);
+    std::vector<size_t>().swap(_hashes);
+    std::vector<tId>().swap(_slots);
+    _mask = 0;
+}
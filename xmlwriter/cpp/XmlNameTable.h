@@ -0,0 +1,57 @@
+//
+//  XmlNameTable.h
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#ifndef XmlNameTable_h
+#define XmlNameTable_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "XmlAttrs.h"
+
+/**
+ * Interned element names.
+ *
+ * Each distinct name is given a small integer ID the first time it is seen.
+ * The element stack of an XmlStream holds these IDs rather than copies of
+ * the names so startElement() does not allocate once a name has been seen
+ * and endElement() copies a pre-built "</name>" rather than building it.
+ *
+ * The table is open addressing with linear probing and only shrinks on
+ * clear(), a document typically has a few tens of distinct names.
+ */
+class XmlNameTable {
+public:
+    using tId = uint32_t;
+
+    XmlNameTable() : _mask(0) {}
+    // Returns the ID of name, adding it if necessary.
+    tId intern(XmlStringView name);
+    // The name for an ID. This is invalidated by the next intern().
+    XmlStringView name(tId id) const {
+        const std::string &tag = _endTags[id];
+        return XmlStringView(tag.data() + 2, tag.size() - 3);
+    }
+    // "</name>" for an ID.
+    const std::string &endTag(tId id) const { return _endTags[id]; }
+    size_t size() const { return _endTags.size(); }
+    // Remove all names and release the memory, all IDs are invalidated.
+    void clear();
+protected:
+    static size_t _hash(XmlStringView name);
+    void _grow();
+protected:
+    // Indexed by ID.
+    std::vector<std::string> _endTags;
+    std::vector<size_t> _hashes;
+    // Each slot is an ID + 1 or 0 if empty, the size is a power of 2.
+    std::vector<tId> _slots;
+    size_t _mask;
+};
+
+#endif /* XmlNameTable_h */
@@ -0,0 +1,163 @@
+//
+//  XmlPolicies.h
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#ifndef XmlPolicies_h
+#define XmlPolicies_h
+
+#include <string>
+#include <vector>
+
+#include "XmlEscape.h"
+
+/**
+ * Compile time policies for BasicXmlStream.
+ *
+ * XmlStream and XhtmlStream use the policies that give the original
+ * behaviour, indentation, escaping per context and checking end element
+ * names. XmlStreamFast and XhtmlStreamFast do not indent or check end element
+ * names so those calls compile away.
+ */
+
+// Text, attribute values and comments are each escaped with only what that
+// context needs, see XmlEscape.h. Define this as 1 to escape all of
+// < > & ' " everywhere as earlier versions did.
+#ifndef XML_WRITE_STRICT_ESCAPING
+#define XML_WRITE_STRICT_ESCAPING 0
+#endif
+
+/*************** Indentation **************/
+// Indents each start and end tag by the element depth unless the element,
+// or any parent, contains mixed content.
+class XmlIndentStack {
+public:
+    explicit XmlIndentStack(bool mustIndent) : _mustIndent(mustIndent),
+                                               _noIndentCount(0),
+                                               _indentString("  "),
+                                               _indentBuffer("\n") {}
+    bool mustIndent() const { return _mustIndent; }
+    // Return to the state after construction, keeping the memory.
+    void reset(bool mustIndent) {
+        _mustIndent = mustIndent;
+        _canIndentStk.clear();
+        _noIndentCount = 0;
+        if (_indentString != "  ") {
+            indentString("  ");
+        }
+    }
+    // O(1), this keeps a count of the frames that can not be indented.
+    bool canIndent() const { return _noIndentCount == 0; }
+    void push() {
+        _canIndentStk.push_back(_mustIndent);
+        if (! _mustIndent) {
+            ++_noIndentCount;
+        }
+    }
+    void pop() {
+        if (! _canIndentStk.back()) {
+            --_noIndentCount;
+        }
+        _canIndentStk.pop_back();
+    }
+    // Set whether the innermost element can be indented.
+    void flip(bool theBool) {
+        if (_canIndentStk.empty()) {
+            return;
+        }
+        std::vector<bool>::reference value = _canIndentStk.back();
+        if (value != theBool) {
+            if (theBool) {
+                --_noIndentCount;
+            } else {
+                ++_noIndentCount;
+            }
+            value = theBool;
+        }
+    }
+    // The string written once per level of indentation, the default is two
+    // spaces. For example "\t" or std::string(4, ' ').
+    void indentString(const std::string &theIndent) {
+        _indentString = theIndent;
+        _indentBuffer = "\n";
+    }
+    const std::string &indentString() const { return _indentString; }
+    // Write a newline and levels of indentation as a single write from a
+    // cached buffer.
+    template <typename Output>
+    void write(Output &output, size_t levels) {
+        if (canIndent()) {
+            size_t len = 1 + levels * _indentString.size();
+            while (_indentBuffer.size() < len) {
+                _indentBuffer += _indentString;
+            }
+            output.write(_indentBuffer.data(), len);
+        }
+    }
+protected:
+    bool _mustIndent;
+    std::vector<bool> _canIndentStk;
+    size_t _noIndentCount;
+    std::string _indentString;
+    // A newline followed by _indentString repeated for the deepest element
+    // so far.
+    std::string _indentBuffer;
+};
+
+// No indentation at all, mustIndent is ignored.
+class XmlIndentNone {
+public:
+    explicit XmlIndentNone(bool /* mustIndent */) {}
+    bool mustIndent() const { return false; }
+    void reset(bool /* mustIndent */) {}
+    bool canIndent() const { return false; }
+    void push() {}
+    void pop() {}
+    void flip(bool /* theBool */) {}
+    void indentString(const std::string & /* theIndent */) {}
+    const std::string &indentString() const {
+        static const std::string empty;
+        return empty;
+    }
+    template <typename Output>
+    void write(Output & /* output */, size_t /* levels */) {}
+};
+
+/*************** Escaping **************/
+// Each context escapes only what it needs and comments have "--" split.
+struct XmlEscapeByContext {
+    static const XmlEscapeContext TEXT = XML_ESCAPE_TEXT;
+    static const XmlEscapeContext ATTRIBUTE = XML_ESCAPE_ATTRIBUTE;
+    // If true comments are escaped as TEXT, otherwise "--" is split.
+    static const bool ESCAPE_COMMENT = false;
+};
+
+// Escape all of < > & ' " everywhere, including comments.
+struct XmlEscapeStrict {
+    static const XmlEscapeContext TEXT = XML_ESCAPE_ALL;
+    static const XmlEscapeContext ATTRIBUTE = XML_ESCAPE_ALL;
+    static const bool ESCAPE_COMMENT = true;
+};
+
+#if XML_WRITE_STRICT_ESCAPING
+using XmlEscapeDefault = XmlEscapeStrict;
+#else
+using XmlEscapeDefault = XmlEscapeByContext;
+#endif
+
+/*************** Checking **************/
+// endElement() checks the name and raises an ExceptionXmlEndElement on a
+// mismatch. Element::_close() always checks the depth whatever the policy.
+struct XmlCheckNames {
+    static const bool CHECK = true;
+};
+
+// endElement() ignores the name and closes the innermost element.
+// Ending an element when none is open still raises.
+struct XmlCheckNone {
+    static const bool CHECK = false;
+};
+
+#endif /* XmlPolicies_h */
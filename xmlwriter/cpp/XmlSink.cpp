@@ -0,0 +1,427 @@
+//
+//  XmlSink.cpp
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "XmlSink.h"
+#include "XmlWrite.h"
+
+/*************** XmlBlockingSection **************/
+XmlBlockingSection::tBegin XmlBlockingSection::_begin = nullptr;
+XmlBlockingSection::tEnd XmlBlockingSection::_end = nullptr;
+
+/*************** XmlSinkFd **************/
+XmlSinkFd::XmlSinkFd(int fd, bool closeFd) : _fd(fd), _closeFd(closeFd) {
+    if (_fd < 0) {
+        std::ostringstream err;
+        err << "Invalid file descriptor " << fd;
+        throw ExceptionXml(err.str());
+    }
+}
+
+XmlSinkFd::XmlSinkFd(const std::string &path) : _fd(-1), _closeFd(true) {
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (_fd < 0) {
+        std::ostringstream err;
+        err << "Can not open \"" << path << "\": " << std::strerror(errno);
+        throw ExceptionXml(err.str());
+    }
+}
+
+XmlSinkFd::~XmlSinkFd() {
+    if (_closeFd && _fd >= 0) {
+        ::close(_fd);
+    }
+}
+
+void XmlSinkFd::write(const char *data, size_t len) {
+    // This blocks if the reader of a pipe or the file system is slow.
+    XmlBlockingSection blocking;
+    while (len) {
+        ssize_t written = ::write(_fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::ostringstream err;
+            err << "write() to file descriptor " << _fd << " failed: ";
+            err << std::strerror(errno);
+            throw ExceptionXml(err.str());
+        }
+        data += written;
+        len -= static_cast<size_t>(written);
+    }
+}
+
+void XmlSinkFd::close() {
+    if (_closeFd && _fd >= 0) {
+        int result;
+        {
+            XmlBlockingSection blocking;
+            result = ::close(_fd);
+        }
+        _fd = -1;
+        if (result) {
+            std::ostringstream err;
+            err << "close() failed: " << std::strerror(errno);
+            throw ExceptionXml(err.str());
+        }
+    }
+}
+
+/*************** XmlSinkThread **************/
+XmlSinkThread::XmlSinkThread(std::unique_ptr<XmlSink> theTarget) :
+    _target(std::move(theTarget)),
+    _hasPending(false),
+    _writing(false),
+    _stopping(false),
+    _failed(false),
+    _thread(&XmlSinkThread::_run, this) {}
+
+XmlSinkThread::~XmlSinkThread() {
+    _stop();
+}
+
+void XmlSinkThread::write(const char *data, size_t len) {
+    std::string buffer(data, len);
+    writeBuffer(buffer);
+}
+
+void XmlSinkThread::writeBuffer(std::string &buffer) {
+    // The thread may be waiting for the reader of a pipe, or for the target
+    // to take the GIL. This is outside the lock so that the lock is released
+    // before the section ends.
+    XmlBlockingSection blocking;
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cond.wait(lock, [this] { return ! _hasPending; });
+    if (_failed) {
+        throw ExceptionXml(_error);
+    }
+    // buffer is now the empty one previously written by the thread.
+    _pending.swap(buffer);
+    _hasPending = true;
+    lock.unlock();
+    _cond.notify_all();
+}
+
+void XmlSinkThread::close() {
+    _stop();
+    if (_failed) {
+        throw ExceptionXml(_error);
+    }
+    _target->close();
+}
+
+void XmlSinkThread::_run() {
+    std::string writing;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _cond.wait(lock, [this] { return _hasPending || _stopping; });
+        if (! _hasPending) {
+            break;
+        }
+        writing.swap(_pending);
+        _hasPending = false;
+        _writing = true;
+        lock.unlock();
+        _cond.notify_all();
+        std::string error;
+        try {
+            _target->write(writing.data(), writing.size());
+        } catch (ExceptionXml &err) {
+            error = err.message();
+        } catch (std::exception &err) {
+            // For example std::bad_alloc, this must not escape the thread.
+            error = err.what();
+        }
+        // Keeps the capacity.
+        writing.clear();
+        lock.lock();
+        if (! error.empty() && ! _failed) {
+            _failed = true;
+            _error = error;
+        }
+        _writing = false;
+        _cond.notify_all();
+    }
+}
+
+void XmlSinkThread::_stop() {
+    if (! _thread.joinable()) {
+        return;
+    }
+    // As writeBuffer(), the thread may need the GIL to finish.
+    XmlBlockingSection blocking;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [this] { return ! _hasPending && ! _writing; });
+        _stopping = true;
+    }
+    _cond.notify_all();
+    _thread.join();
+}
+
+/*************** XmlSinkUtf8 **************/
+// Returns the length of data that ends on a UTF-8 character boundary.
+static size_t utf8_complete_length(const char *data, size_t len) {
+    // Look back at most three bytes for the lead byte of the last character.
+    size_t i = len;
+    while (i > 0 && len - i < 4) {
+        unsigned char c = static_cast<unsigned char>(data[i - 1]);
+        if ((c & 0xC0) != 0x80) {
+            // ASCII or a lead byte.
+            size_t need = 1;
+            if ((c & 0xE0) == 0xC0) {
+                need = 2;
+            } else if ((c & 0xF0) == 0xE0) {
+                need = 3;
+            } else if ((c & 0xF8) == 0xF0) {
+                need = 4;
+            }
+            return (len - (i - 1) >= need) ? len : i - 1;
+        }
+        --i;
+    }
+    // Not UTF-8, let the decoder report it.
+    return len;
+}
+
+void XmlSinkUtf8::write(const char *data, size_t len) {
+    if (_pending.size()) {
+        _pending.append(data, len);
+        size_t complete = utf8_complete_length(_pending.data(), _pending.size());
+        if (complete) {
+            writeUtf8(_pending.data(), complete);
+        }
+        _pending.erase(0, complete);
+    } else {
+        size_t complete = utf8_complete_length(data, len);
+        if (complete) {
+            writeUtf8(data, complete);
+        }
+        _pending.assign(data + complete, len - complete);
+    }
+}
+
+void XmlSinkUtf8::close() {
+    if (_pending.size()) {
+        // Incomplete sequence at the end, let the decoder report it.
+        std::string pending;
+        pending.swap(_pending);
+        writeUtf8(pending.data(), pending.size());
+    }
+}
+
+/*************** XmlSizeProfiles **************/
+namespace {
+    std::mutex size_profiles_mutex;
+    std::unordered_map<std::string, size_t> size_profiles;
+}
+
+size_t XmlSizeProfiles::expected(const std::string &key) {
+    std::lock_guard<std::mutex> lock(size_profiles_mutex);
+    auto iter = size_profiles.find(key);
+    if (iter == size_profiles.end()) {
+        return 0;
+    }
+    // Some headroom for a slightly larger document.
+    return iter->second + iter->second / 16;
+}
+
+void XmlSizeProfiles::record(const std::string &key, size_t size) {
+    std::lock_guard<std::mutex> lock(size_profiles_mutex);
+    size_t &value = size_profiles[key];
+    // Decay by 1/4 so one unusually large document is soon forgotten.
+    size_t decayed = value - value / 4;
+    value = size > decayed ? size : decayed;
+}
+
+void XmlSizeProfiles::clear() {
+    std::lock_guard<std::mutex> lock(size_profiles_mutex);
+    size_profiles.clear();
+}
+
+/*************** XmlBuffer **************/
+const size_t XmlBuffer::DEFAULT_FLUSH_SIZE;
+const size_t XmlBuffer::CHUNK_SIZE;
+
+// The most spare chunks kept for reuse.
+static const size_t MAX_SPARE_CHUNKS = 16;
+
+std::string XmlBuffer::copy() const {
+    std::string result;
+    result.reserve(size());
+    for (const auto &chunk: _chunks) {
+        result.append(chunk);
+    }
+    result.append(_buffer);
+    return result;
+}
+
+size_t XmlBuffer::capacity() const {
+    size_t result = _buffer.capacity();
+    for (const auto &chunk: _chunks) {
+        result += chunk.capacity();
+    }
+    for (const auto &chunk: _spare) {
+        result += chunk.capacity();
+    }
+    return result;
+}
+
+std::string XmlBuffer::take() {
+    if (_exports || _flushing) {
+        _throwBusy();
+    }
+    if (! _chunks.empty()) {
+        _join();
+    }
+    std::string result;
+    result.swap(_buffer);
+    return result;
+}
+
+void XmlBuffer::writeTo(int fd) const {
+    std::vector<struct iovec> iov;
+    iov.reserve(_chunks.size() + 1);
+    for (const auto &chunk: _chunks) {
+        iov.push_back({ const_cast<char *>(chunk.data()), chunk.size() });
+    }
+    if (_buffer.size()) {
+        iov.push_back({ const_cast<char *>(_buffer.data()), _buffer.size() });
+    }
+    size_t index = 0;
+    while (index < iov.size()) {
+        int count = static_cast<int>(std::min<size_t>(iov.size() - index, IOV_MAX));
+        ssize_t written = ::writev(fd, iov.data() + index, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::ostringstream err;
+            err << "writev() to file descriptor " << fd << " failed: ";
+            err << std::strerror(errno);
+            throw ExceptionXml(err.str());
+        }
+        // Skip what was written, a partial write can end within an iovec.
+        size_t remaining = static_cast<size_t>(written);
+        while (index < iov.size() && remaining >= iov[index].iov_len) {
+            remaining -= iov[index].iov_len;
+            ++index;
+        }
+        if (remaining) {
+            iov[index].iov_base = static_cast<char *>(iov[index].iov_base) + remaining;
+            iov[index].iov_len -= remaining;
+        }
+    }
+}
+
+void XmlBuffer::flush() {
+    if (_flushing) {
+        _throwBusy();
+    }
+    if (_sink && _buffer.size()) {
+        _flushing = true;
+        try {
+            _sink->writeBuffer(_buffer);
+        } catch (...) {
+            _flushing = false;
+            throw;
+        }
+        _flushing = false;
+    }
+}
+
+void XmlBuffer::_throwBusy() const {
+    std::ostringstream err;
+    if (_flushing) {
+        err << "Can not use a stream while it is being flushed by another thread.";
+    } else {
+        err << "Can not write to a stream while its buffer is exported (";
+        err << _exports << " exports).";
+    }
+    throw ExceptionXml(err.str());
+}
+
+void XmlBuffer::_newChunk() {
+    _chunksSize += _buffer.size();
+    _chunks.push_back(std::move(_buffer));
+    if (_spare.empty()) {
+        _buffer = std::string();
+        _buffer.reserve(CHUNK_SIZE);
+    } else {
+        _buffer = std::move(_spare.back());
+        _spare.pop_back();
+    }
+}
+
+void XmlBuffer::_join() {
+    std::string result;
+    result.reserve(size());
+    // Release each chunk once it is copied so that the peak memory is
+    // little more than the document, the pages of result are only touched
+    // as it is filled. None are kept as spares, the joined buffer is at
+    // least as large as they were.
+    for (auto &chunk: _chunks) {
+        result.append(chunk);
+        std::string().swap(chunk);
+    }
+    _chunks.clear();
+    _chunksSize = 0;
+    result.append(_buffer);
+    _buffer = std::move(result);
+}
+
+void XmlBuffer::_recycleChunks() {
+    for (auto &chunk: _chunks) {
+        if (_spare.size() == MAX_SPARE_CHUNKS) {
+            break;
+        }
+        chunk.clear();
+        _spare.push_back(std::move(chunk));
+    }
+    _chunks.clear();
+    _chunksSize = 0;
+}
+
+void XmlBuffer::close() {
+    flush();
+    if (_sink) {
+        _flushing = true;
+        try {
+            _sink->close();
+        } catch (...) {
+            _flushing = false;
+            throw;
+        }
+        _flushing = false;
+    }
+}
+
+void XmlBuffer::reset(std::unique_ptr<XmlSink> theSink, size_t theFlushSize) {
+    if (_exports || _flushing) {
+        _throwBusy();
+    }
+    _recycleChunks();
+    // Keeps the capacity.
+    _buffer.clear();
+    _sink = std::move(theSink);
+    _flushSize = theFlushSize ? theFlushSize : DEFAULT_FLUSH_SIZE;
+    if (_sink) {
+        _buffer.reserve(_flushSize);
+    }
+}
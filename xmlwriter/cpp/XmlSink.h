@@ -0,0 +1,303 @@
+//
+//  XmlSink.h
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#ifndef XmlSink_h
+#define XmlSink_h
+
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Destinations for the bytes written by an XmlStream.
+ *
+ * The stream always writes into an XmlBuffer. If the buffer has no sink then
+ * it accumulates the whole document in memory, this is the original
+ * behaviour and getvalue() returns the document.
+ * If the buffer has a sink then once the buffer reaches its flush size the
+ * pending bytes are handed to the sink and the buffer is cleared so memory
+ * use is bounded by the flush size rather than the document size.
+ *
+ * Sinks report errors by throwing an ExceptionXml.
+ */
+
+// Operations that may block, such as write(2) or waiting for another thread,
+// are done within an XmlBlockingSection so that a binding can release a
+// global lock for their duration, for example the Python GIL. The hooks are
+// set once when the binding is initialised, begin() returns a state that is
+// given to end(). By default they are not set and nothing is done.
+class XmlBlockingSection {
+public:
+    using tBegin = void *(*)();
+    using tEnd = void (*)(void *);
+    static void setHooks(tBegin theBegin, tEnd theEnd) {
+        _begin = theBegin;
+        _end = theEnd;
+    }
+    XmlBlockingSection() : _state(_begin ? _begin() : nullptr) {}
+    ~XmlBlockingSection() {
+        if (_end) {
+            _end(_state);
+        }
+    }
+    XmlBlockingSection(const XmlBlockingSection &) = delete;
+    XmlBlockingSection &operator=(const XmlBlockingSection &) = delete;
+private:
+    static tBegin _begin;
+    static tEnd _end;
+    void *_state;
+};
+
+// Abstract destination for the bytes of a document.
+class XmlSink {
+public:
+    virtual ~XmlSink() {}
+    // Consume len bytes of data.
+    virtual void write(const char *data, size_t len) = 0;
+    // Consume the bytes in buffer and leave it empty, a sink may exchange
+    // it for another buffer rather than copy it.
+    virtual void writeBuffer(std::string &buffer) {
+        write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+    // Called once when the document is complete, after the final write().
+    virtual void close() {}
+};
+
+// Writes to a raw file descriptor with write(2).
+class XmlSinkFd : public XmlSink {
+public:
+    // Use an existing file descriptor, if closeFd is true then it is closed
+    // by close() or the destructor.
+    explicit XmlSinkFd(int fd, bool closeFd=false);
+    // Open (create or truncate) the file at path, this sink owns the
+    // descriptor.
+    explicit XmlSinkFd(const std::string &path);
+    virtual ~XmlSinkFd();
+    virtual void write(const char *data, size_t len);
+    virtual void close();
+    int fd() const { return _fd; }
+protected:
+    int _fd;
+    bool _closeFd;
+};
+
+// Passes each chunk of bytes to a user supplied function.
+class XmlSinkCallback : public XmlSink {
+public:
+    using tCallback = std::function<void(const char *data, size_t len)>;
+    explicit XmlSinkCallback(const tCallback &theCallback) : _callback(theCallback) {}
+    virtual void write(const char *data, size_t len) {
+        _callback(data, len);
+    }
+protected:
+    tCallback _callback;
+};
+
+// Writes to another sink on a background thread so that generating the
+// document overlaps with writing it. The stream fills one buffer while the
+// thread writes the other, the buffers are exchanged on each flush and the
+// stream only waits if the thread is still writing the previous one.
+// The target is only called from the thread so it must not need the Python
+// GIL, for example an XmlSinkFd.
+// A failure of the target is raised by the next write() or by close().
+class XmlSinkThread : public XmlSink {
+public:
+    explicit XmlSinkThread(std::unique_ptr<XmlSink> theTarget);
+    // Writes anything pending but does not close the target.
+    virtual ~XmlSinkThread();
+    virtual void write(const char *data, size_t len);
+    virtual void writeBuffer(std::string &buffer);
+    // Waits for the thread to write everything then closes the target.
+    virtual void close();
+protected:
+    void _run();
+    // Wait until nothing is pending then stop and join the thread.
+    void _stop();
+protected:
+    std::unique_ptr<XmlSink> _target;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    // Handed to the thread when _hasPending is true.
+    std::string _pending;
+    bool _hasPending;
+    bool _writing;
+    bool _stopping;
+    bool _failed;
+    std::string _error;
+    std::thread _thread;
+};
+
+// Base class for sinks that need every chunk to be complete UTF-8, for
+// example to decode it into a Python str. A multi-byte sequence that is
+// split by a flush is held back until the next write() or close().
+class XmlSinkUtf8 : public XmlSink {
+public:
+    virtual void write(const char *data, size_t len);
+    virtual void close();
+protected:
+    virtual void writeUtf8(const char *data, size_t len) = 0;
+    std::string _pending;
+};
+
+// The final sizes of in memory documents by a "profile" key chosen by the
+// caller, for example the name of a report, so that the next stream with
+// that key can reserve its buffer once rather than growing it repeatedly.
+// A larger document replaces the size immediately, smaller ones reduce it
+// gradually. This is shared by all threads.
+class XmlSizeProfiles {
+public:
+    // The size to reserve for a document with this key, 0 if unknown.
+    static size_t expected(const std::string &key);
+    static void record(const std::string &key, size_t size);
+    static void clear();
+};
+
+// The output buffer of an XmlStream, optionally flushing to a sink.
+// The write methods are inline as they are on the hot path.
+// As a sink may release a global lock while it blocks, see
+// XmlBlockingSection, writing while the buffer is being flushed raises an
+// ExceptionXml rather than corrupting it. A stream must only be used by one
+// thread at a time.
+//
+// An in memory document is held as a list of chunks rather than one string
+// so that a large document is never copied as it grows. Once the current
+// chunk is at least CHUNK_SIZE and full it is moved to the list and a new
+// chunk is started, reusing the memory of a previous one if possible. The
+// chunks are joined only when contiguous memory is needed, by str() and
+// pin(), or they can be written to a file with writeTo() without joining.
+// Memory reserved with reserve() is used before starting a new chunk so a
+// document within its size hint is a single chunk.
+class XmlBuffer {
+public:
+    static const size_t DEFAULT_FLUSH_SIZE = 64 * 1024;
+    static const size_t CHUNK_SIZE = 256 * 1024;
+
+    XmlBuffer() : _flushSize(DEFAULT_FLUSH_SIZE), _chunksSize(0), _exports(0),
+        _flushing(false) {}
+    XmlBuffer(std::unique_ptr<XmlSink> theSink, size_t theFlushSize) :
+        _sink(std::move(theSink)),
+        _flushSize(theFlushSize ? theFlushSize : DEFAULT_FLUSH_SIZE),
+        _chunksSize(0),
+        _exports(0),
+        _flushing(false) {
+        if (_sink) {
+            _buffer.reserve(_flushSize);
+        }
+    }
+    void write(const char *data, size_t len) {
+        checkNotBusy();
+        if (_buffer.size() + len > _buffer.capacity()
+            && _buffer.capacity() >= CHUNK_SIZE && ! _sink) {
+            _newChunk();
+        }
+        _buffer.append(data, len);
+        if (_sink && _buffer.size() >= _flushSize) {
+            flush();
+        }
+    }
+    XmlBuffer &operator<<(char c) {
+        write(&c, 1);
+        return *this;
+    }
+    XmlBuffer &operator<<(const char *s) {
+        write(s, std::strlen(s));
+        return *this;
+    }
+    XmlBuffer &operator<<(const std::string &s) {
+        write(s.data(), s.size());
+        return *this;
+    }
+    // The bytes held in memory as one string, this is the complete document
+    // if there is no sink. This joins the chunks, once.
+    const std::string &str() {
+        if (! _chunks.empty()) {
+            _join();
+        }
+        return _buffer;
+    }
+    // A copy of the bytes held in memory without joining the chunks.
+    std::string copy() const;
+    // The number of bytes held in memory.
+    size_t size() const { return _chunksSize + _buffer.size(); }
+    // The memory held, including spare chunks.
+    size_t capacity() const;
+    // Reserve memory for a document of size bytes.
+    void reserve(size_t size) {
+        checkNotBusy();
+        if (size > this->size()) {
+            _buffer.reserve(_buffer.size() + size - this->size());
+        }
+    }
+    bool hasSink() const { return _sink.get() != nullptr; }
+    XmlSink *sink() { return _sink.get(); }
+    // Remove and return the bytes held in memory, the memory is released.
+    std::string take();
+    // Write the bytes held in memory to a file descriptor with writev(2),
+    // the chunks are not joined. Raises an ExceptionXml on failure.
+    void writeTo(int fd) const;
+    // Hand any pending bytes to the sink, if any.
+    void flush();
+    // Flush then close the sink, if any.
+    void close();
+    // Discard the bytes held in memory, keeping the capacity, and replace
+    // the sink. Raises an ExceptionXml if the memory is exported.
+    void reset(std::unique_ptr<XmlSink> theSink, size_t theFlushSize);
+    // Export the memory without copying it, for example with the Python
+    // buffer protocol. Until the matching unpin() any write raises an
+    // ExceptionXml as it might move the memory.
+    const std::string &pin() {
+        const std::string &result = str();
+        ++_exports;
+        return result;
+    }
+    void unpin() {
+        if (_exports) {
+            --_exports;
+        }
+    }
+    size_t exports() const { return _exports; }
+    // True if a write would raise as the memory is exported or being
+    // flushed. A flush may release the GIL or call Python so a binding
+    // checks this before reusing memory that an outer write may still use.
+    bool busy() const { return _exports || _flushing; }
+    // Raise an ExceptionXml if busy().
+    void checkNotBusy() const {
+        if (busy()) {
+            _throwBusy();
+        }
+    }
+protected:
+    // Raise an ExceptionXml as the memory is exported or being flushed.
+    void _throwBusy() const;
+    // Move _buffer to _chunks and start a new chunk.
+    void _newChunk();
+    // Join _chunks and _buffer into _buffer.
+    void _join();
+    // Keep the memory of the chunks for reuse, up to a limit.
+    void _recycleChunks();
+protected:
+    // The current chunk, the last part of the document.
+    std::string _buffer;
+    std::unique_ptr<XmlSink> _sink;
+    size_t _flushSize;
+    // Full chunks, in order, and their total size.
+    std::vector<std::string> _chunks;
+    size_t _chunksSize;
+    // Empty chunks with their memory for reuse.
+    std::vector<std::string> _spare;
+    size_t _exports;
+    // True while the sink is called by flush() or close().
+    bool _flushing;
+};
+
+#endif /* XmlSink_h */
@@ -0,0 +1,386 @@
+//
+//  XmlSinkZlib.cpp
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#include <climits>
+#include <cstring>
+#include <sstream>
+
+#include "XmlSinkZlib.h"
+#include "XmlWrite.h"
+
+const size_t XmlSinkZlib::OUTPUT_SIZE;
+
+static std::string zlib_error_message(const char *function, int result,
+                                      const z_stream &stream) {
+    std::ostringstream err;
+    err << function << "() failed: " << result;
+    if (stream.msg) {
+        err << " " << stream.msg;
+    }
+    return err.str();
+}
+
+static void throw_zlib_error(const char *function, int result, const z_stream &stream) {
+    throw ExceptionXml(zlib_error_message(function, result, stream));
+}
+
+static void check_level(int level) {
+    if (level != Z_DEFAULT_COMPRESSION && (level < 0 || level > 9)) {
+        std::ostringstream err;
+        err << "Compression level must be 0 to 9 not " << level;
+        throw ExceptionXml(err.str());
+    }
+}
+
+XmlSinkZlib::XmlSinkZlib(std::unique_ptr<XmlSink> theTarget,
+                         int theLevel,
+                         Format theFormat,
+                         size_t theSyncSize) : _target(std::move(theTarget)),
+                                               _open(false),
+                                               _syncSize(theSyncSize),
+                                               _sinceSync(0),
+                                               _output(OUTPUT_SIZE, '\0') {
+    check_level(theLevel);
+    std::memset(&_stream, 0, sizeof(_stream));
+    // 16 adds the gzip header and trailer.
+    int window_bits = theFormat == FORMAT_GZIP ? MAX_WBITS + 16 : MAX_WBITS;
+    int result = deflateInit2(&_stream, theLevel, Z_DEFLATED, window_bits, 8,
+                              Z_DEFAULT_STRATEGY);
+    if (result != Z_OK) {
+        throw_zlib_error("deflateInit2", result, _stream);
+    }
+    _open = true;
+}
+
+XmlSinkZlib::~XmlSinkZlib() {
+    if (_open) {
+        deflateEnd(&_stream);
+    }
+}
+
+void XmlSinkZlib::write(const char *data, size_t len) {
+    _deflate(data, len, Z_NO_FLUSH);
+    if (_syncSize) {
+        _sinceSync += len;
+        if (_sinceSync >= _syncSize) {
+            _deflate(nullptr, 0, Z_SYNC_FLUSH);
+            _sinceSync = 0;
+        }
+    }
+}
+
+void XmlSinkZlib::close() {
+    if (_open) {
+        _deflate(nullptr, 0, Z_FINISH);
+        deflateEnd(&_stream);
+        _open = false;
+    }
+    _target->close();
+}
+
+void XmlSinkZlib::_deflate(const char *data, size_t len, int flush) {
+    if (! _open) {
+        throw ExceptionXml("Can not write to a closed compressed stream");
+    }
+    // avail_in is a uInt so very large input is given in parts.
+    do {
+        size_t part = len < UINT_MAX ? len : UINT_MAX;
+        _stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        _stream.avail_in = static_cast<uInt>(part);
+        int part_flush = part == len ? flush : Z_NO_FLUSH;
+        int result;
+        do {
+            _stream.next_out = reinterpret_cast<Bytef *>(&_output[0]);
+            _stream.avail_out = static_cast<uInt>(_output.size());
+            result = deflate(&_stream, part_flush);
+            if (result == Z_STREAM_ERROR) {
+                throw_zlib_error("deflate", result, _stream);
+            }
+            size_t have = _output.size() - _stream.avail_out;
+            if (have) {
+                _target->write(_output.data(), have);
+            }
+            // Z_FINISH is complete at Z_STREAM_END, otherwise when there is
+            // space left in the output.
+        } while (part_flush == Z_FINISH ? result != Z_STREAM_END : _stream.avail_out == 0);
+        data += part;
+        len -= part;
+    } while (len);
+}
+
+/*************** XmlSinkZlibParallel **************/
+const size_t XmlSinkZlibParallel::BLOCK_SIZE;
+const size_t XmlSinkZlibParallel::DICTIONARY_SIZE;
+
+// avail_in is a uInt so a block is given to deflate() in one call.
+static const size_t MAX_BLOCK_SIZE = 1 << 30;
+
+XmlSinkZlibParallel::XmlSinkZlibParallel(std::unique_ptr<XmlSink> theTarget,
+                                         int theLevel,
+                                         XmlSinkZlib::Format theFormat,
+                                         size_t theThreads,
+                                         size_t theBlockSize) : _target(std::move(theTarget)),
+                                                                _level(theLevel),
+                                                                _format(theFormat),
+                                                                _blockSize(theBlockSize),
+                                                                _open(true),
+                                                                _started(false),
+                                                                _current(new tBlock()),
+                                                                _check(0),
+                                                                _totalSize(0),
+                                                                _stopping(false) {
+    check_level(theLevel);
+    if (_blockSize == 0) {
+        _blockSize = BLOCK_SIZE;
+    } else if (_blockSize > MAX_BLOCK_SIZE) {
+        _blockSize = MAX_BLOCK_SIZE;
+    }
+    if (_format == XmlSinkZlib::FORMAT_GZIP) {
+        _check = crc32(0L, Z_NULL, 0);
+    } else {
+        _check = adler32(0L, Z_NULL, 0);
+    }
+    if (theThreads == 0) {
+        theThreads = std::thread::hardware_concurrency();
+        if (theThreads == 0) {
+            theThreads = 1;
+        }
+    }
+    _current->input.reserve(_blockSize);
+    for (size_t i = 0; i < theThreads; ++i) {
+        _threads.emplace_back(&XmlSinkZlibParallel::_run, this);
+    }
+}
+
+XmlSinkZlibParallel::~XmlSinkZlibParallel() {
+    _stop();
+}
+
+void XmlSinkZlibParallel::write(const char *data, size_t len) {
+    if (! _open) {
+        throw ExceptionXml("Can not write to a closed compressed stream");
+    }
+    while (len) {
+        size_t part = _blockSize - _current->input.size();
+        if (part > len) {
+            part = len;
+        }
+        _current->input.append(data, part);
+        data += part;
+        len -= part;
+        if (_current->input.size() == _blockSize) {
+            _submit(false);
+        }
+    }
+}
+
+void XmlSinkZlibParallel::close() {
+    if (_open) {
+        // The last block may be empty, it still ends the deflate stream.
+        _submit(true);
+        while (_writeFront(true)) {}
+        _open = false;
+        unsigned char trailer[8];
+        size_t trailer_size;
+        if (_format == XmlSinkZlib::FORMAT_GZIP) {
+            // CRC-32 then the size modulo 2**32, both little endian.
+            for (int i = 0; i < 4; ++i) {
+                trailer[i] = static_cast<unsigned char>(_check >> (8 * i));
+                trailer[4 + i] = static_cast<unsigned char>(_totalSize >> (8 * i));
+            }
+            trailer_size = 8;
+        } else {
+            // Adler-32, big endian.
+            for (int i = 0; i < 4; ++i) {
+                trailer[i] = static_cast<unsigned char>(_check >> (8 * (3 - i)));
+            }
+            trailer_size = 4;
+        }
+        _target->write(reinterpret_cast<const char *>(trailer), trailer_size);
+        _stop();
+    }
+    _target->close();
+}
+
+void XmlSinkZlibParallel::_submit(bool last) {
+    tBlock *block = _current.get();
+    block->last = last;
+    block->done = false;
+    block->error.clear();
+    std::unique_ptr<tBlock> next;
+    if (! last) {
+        if (_spare.empty()) {
+            next.reset(new tBlock());
+            next->input.reserve(_blockSize);
+        } else {
+            next = std::move(_spare.back());
+            _spare.pop_back();
+            next->input.clear();
+        }
+        size_t tail = block->input.size() < DICTIONARY_SIZE ? block->input.size() : DICTIONARY_SIZE;
+        next->dictionary.assign(block->input, block->input.size() - tail, tail);
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _blocks.push_back(std::move(_current));
+        _todo.push_back(block);
+    }
+    _cond.notify_all();
+    _current = std::move(next);
+    // Write whatever is finished, waiting if too many blocks are held.
+    while (_writeFront(_blocks.size() >= 2 * _threads.size())) {}
+}
+
+bool XmlSinkZlibParallel::_writeFront(bool wait) {
+    if (wait) {
+        // The threads do not need the GIL so other Python threads can run
+        // meanwhile. Only this thread adds or removes blocks so the front
+        // block is still done after the lock is released.
+        XmlBlockingSection blocking;
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [this] { return _blocks.empty() || _blocks.front()->done; });
+    }
+    std::unique_ptr<tBlock> block;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_blocks.empty() || ! _blocks.front()->done) {
+            return false;
+        }
+        block = std::move(_blocks.front());
+        _blocks.pop_front();
+    }
+    if (! block->error.empty()) {
+        _open = false;
+        throw ExceptionXml(block->error);
+    }
+    if (! _started) {
+        _writeHeader();
+        _started = true;
+    }
+    _target->write(block->output.data(), block->output.size());
+    if (_format == XmlSinkZlib::FORMAT_GZIP) {
+        _check = crc32_combine(_check, block->check, block->input.size());
+    } else {
+        _check = adler32_combine(_check, block->check, block->input.size());
+    }
+    _totalSize += block->input.size();
+    if (_spare.size() < 2 * _threads.size()) {
+        _spare.push_back(std::move(block));
+    }
+    return true;
+}
+
+void XmlSinkZlibParallel::_writeHeader() {
+    if (_format == XmlSinkZlib::FORMAT_GZIP) {
+        // Magic, deflate, no flags, no time, no extra flags, Unix.
+        static const unsigned char header[10] = {
+            0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3
+        };
+        _target->write(reinterpret_cast<const char *>(header), sizeof(header));
+    } else {
+        // Deflate with a 32kB window, the default level.
+        static const unsigned char header[2] = { 0x78, 0x9c };
+        _target->write(reinterpret_cast<const char *>(header), sizeof(header));
+    }
+}
+
+void XmlSinkZlibParallel::_compress(z_stream &stream, tBlock &block) {
+    int result = deflateReset(&stream);
+    if (result != Z_OK) {
+        throw_zlib_error("deflateReset", result, stream);
+    }
+    if (! block.dictionary.empty()) {
+        result = deflateSetDictionary(&stream,
+                                      reinterpret_cast<const Bytef *>(block.dictionary.data()),
+                                      static_cast<uInt>(block.dictionary.size()));
+        if (result != Z_OK) {
+            throw_zlib_error("deflateSetDictionary", result, stream);
+        }
+    }
+    stream.next_in = reinterpret_cast<Bytef *>(&block.input[0]);
+    stream.avail_in = static_cast<uInt>(block.input.size());
+    // Allow for the empty stored block added by Z_SYNC_FLUSH.
+    block.output.resize(deflateBound(&stream, block.input.size()) + 16);
+    int flush = block.last ? Z_FINISH : Z_SYNC_FLUSH;
+    size_t have = 0;
+    while (true) {
+        stream.next_out = reinterpret_cast<Bytef *>(&block.output[have]);
+        stream.avail_out = static_cast<uInt>(block.output.size() - have);
+        result = deflate(&stream, flush);
+        if (result == Z_STREAM_ERROR) {
+            throw_zlib_error("deflate", result, stream);
+        }
+        have = block.output.size() - stream.avail_out;
+        if (flush == Z_FINISH ? result == Z_STREAM_END : stream.avail_out != 0) {
+            break;
+        }
+        block.output.resize(block.output.size() * 2);
+    }
+    block.output.resize(have);
+    if (_format == XmlSinkZlib::FORMAT_GZIP) {
+        block.check = crc32(crc32(0L, Z_NULL, 0),
+                            reinterpret_cast<const Bytef *>(block.input.data()),
+                            static_cast<uInt>(block.input.size()));
+    } else {
+        block.check = adler32(adler32(0L, Z_NULL, 0),
+                              reinterpret_cast<const Bytef *>(block.input.data()),
+                              static_cast<uInt>(block.input.size()));
+    }
+}
+
+void XmlSinkZlibParallel::_run() {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    // Negative window bits for raw deflate, the header and trailer are
+    // written by _writeFront() and close().
+    int init = deflateInit2(&stream, _level, Z_DEFLATED, -MAX_WBITS, 8,
+                            Z_DEFAULT_STRATEGY);
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _cond.wait(lock, [this] { return ! _todo.empty() || _stopping; });
+        if (_stopping) {
+            break;
+        }
+        tBlock *block = _todo.front();
+        _todo.pop_front();
+        lock.unlock();
+        std::string error;
+        if (init != Z_OK) {
+            error = zlib_error_message("deflateInit2", init, stream);
+        } else {
+            try {
+                _compress(stream, *block);
+            } catch (ExceptionXml &err) {
+                error = err.message();
+            } catch (std::exception &err) {
+                // For example std::bad_alloc, this must not escape the thread.
+                error = err.what();
+            }
+        }
+        lock.lock();
+        block->error = error;
+        block->done = true;
+        _cond.notify_all();
+    }
+    lock.unlock();
+    if (init == Z_OK) {
+        deflateEnd(&stream);
+    }
+}
+
+void XmlSinkZlibParallel::_stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cond.notify_all();
+    for (auto &thread: _threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
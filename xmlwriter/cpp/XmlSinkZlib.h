@@ -0,0 +1,146 @@
+//
+//  XmlSinkZlib.h
+//  xmlwriter
+//
+//  Copyright © 2018 Paul Ross. All rights reserved.
+//
+
+#ifndef XmlSinkZlib_h
+#define XmlSinkZlib_h
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#include "XmlSink.h"
+
+/**
+ * A sink that compresses the document with zlib as it is written and passes
+ * the compressed bytes to another sink, for example an XmlSinkFd. Memory use
+ * is bounded by the zlib state and one output buffer, the document is never
+ * held in full.
+ *
+ * To compress on a separate thread wrap this in an XmlSinkThread.
+ */
+class XmlSinkZlib : public XmlSink {
+public:
+    enum Format {
+        // A .gz file.
+        FORMAT_GZIP,
+        // zlib header and checksum, for example HTTP "Content-Encoding: deflate".
+        FORMAT_ZLIB,
+    };
+    static const size_t OUTPUT_SIZE = 64 * 1024;
+
+    // theLevel is 0 to 9 or Z_DEFAULT_COMPRESSION. If theSyncSize is not 0
+    // the compressed output is made complete up to the current position
+    // (Z_SYNC_FLUSH) after every theSyncSize bytes of input so that a reader
+    // can decompress a partial file. This costs some compression.
+    XmlSinkZlib(std::unique_ptr<XmlSink> theTarget,
+                int theLevel=Z_DEFAULT_COMPRESSION,
+                Format theFormat=FORMAT_GZIP,
+                size_t theSyncSize=0);
+    // Does not finish the compressed stream or close the target.
+    virtual ~XmlSinkZlib();
+    virtual void write(const char *data, size_t len);
+    // Finishes the compressed stream then closes the target.
+    virtual void close();
+    XmlSink *target() { return _target.get(); }
+protected:
+    // Compress len bytes then write the output to the target.
+    void _deflate(const char *data, size_t len, int flush);
+protected:
+    std::unique_ptr<XmlSink> _target;
+    z_stream _stream;
+    bool _open;
+    size_t _syncSize;
+    // Input since the last Z_SYNC_FLUSH.
+    size_t _sinceSync;
+    std::string _output;
+};
+
+// Compresses on a pool of threads as pigz does. The input is cut into blocks
+// that are deflated independently, each with the last 32kB of the previous
+// block as its dictionary so the ratio is close to XmlSinkZlib. Each block
+// ends with a Z_SYNC_FLUSH, the last with Z_FINISH, so the compressed blocks
+// concatenate into a single gzip or zlib stream, the checksums are combined
+// with crc32_combine() or adler32_combine().
+// The compressed blocks are written to the target in order by the thread
+// that calls write() and close() so the target may need the Python GIL.
+// At most two blocks per thread are held at once.
+class XmlSinkZlibParallel : public XmlSink {
+public:
+    static const size_t BLOCK_SIZE = 128 * 1024;
+    static const size_t DICTIONARY_SIZE = 32 * 1024;
+
+    // theThreads of 0 uses one thread per core. theBlockSize of 0 uses
+    // BLOCK_SIZE, a reader can decompress a partial file up to the end of
+    // the last block written.
+    XmlSinkZlibParallel(std::unique_ptr<XmlSink> theTarget,
+                        int theLevel=Z_DEFAULT_COMPRESSION,
+                        XmlSinkZlib::Format theFormat=XmlSinkZlib::FORMAT_GZIP,
+                        size_t theThreads=0,
+                        size_t theBlockSize=0);
+    // Stops the threads but does not finish the compressed stream or close
+    // the target.
+    virtual ~XmlSinkZlibParallel();
+    virtual void write(const char *data, size_t len);
+    // Compresses and writes the remaining blocks, the trailer then closes
+    // the target.
+    virtual void close();
+    size_t threads() const { return _threads.size(); }
+    XmlSink *target() { return _target.get(); }
+protected:
+    struct tBlock {
+        // The last DICTIONARY_SIZE bytes of the previous block.
+        std::string dictionary;
+        std::string input;
+        std::string output;
+        uLong check;
+        bool last;
+        bool done;
+        std::string error;
+    };
+    // Queue _current for compression and start a new block.
+    void _submit(bool last);
+    // Write the oldest block to the target, waiting for it if wait is true.
+    // Returns false if it was not written.
+    bool _writeFront(bool wait);
+    // The gzip or zlib header, before the first block.
+    void _writeHeader();
+    // Compress one block, called by the threads without the lock.
+    void _compress(z_stream &stream, tBlock &block);
+    void _run();
+    void _stop();
+protected:
+    std::unique_ptr<XmlSink> _target;
+    int _level;
+    XmlSinkZlib::Format _format;
+    size_t _blockSize;
+    bool _open;
+    // True once the header is written.
+    bool _started;
+    // Filled by write().
+    std::unique_ptr<tBlock> _current;
+    // Submitted blocks in document order, owned here.
+    std::deque<std::unique_ptr<tBlock>> _blocks;
+    // Blocks waiting for a thread, in document order.
+    std::deque<tBlock *> _todo;
+    // Written blocks kept to reuse their memory.
+    std::vector<std::unique_ptr<tBlock>> _spare;
+    // Of the uncompressed document.
+    uLong _check;
+    uLong _totalSize;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    bool _stopping;
+    std::vector<std::thread> _threads;
+};
+
+#endif /* XmlSinkZlib_h */
@@ -1,6 +1,8 @@
 #include <assert.h>
+#include <cstring>
 
 #include "XmlWrite.h"
+#include "XmlEscape.h"
 #include "base64.h"
 
 bool RAISE_ON_ERROR = true;
@@ -13,44 +15,20 @@ std::string encodeString(const std::string &theS,
         err <<theCharPrefix << "\"";
         throw ExceptionXml(err.str());
     }
-    // Threee steps:
-    // * Base64 encoding of theS
-    // * Character substitution of the base64 sting.
-    // * Prepend prefix.
-    std::string base64;
-    base64_encode(theS, base64);
-    for (size_t i = 0; i < base64.size(); ++i) {
-        switch (base64[i]) {
-            case '+':
-                base64[i] = '-';
-                break;
-            case '/':
-                base64[i] = '.';
-                break;
-            case '=':
-                base64[i] = '_';
-                break;
-            default:
-                break;
-        }
-    }
-    return theCharPrefix + base64;
+    // The prefix then the base64 encoding in the XML ID alphabet, in one pass.
+    std::string result;
+    result.reserve(1 + 4 * ((theS.size() + 2) / 3));
+    result += theCharPrefix;
+    base64_encode(theS.data(), theS.size(), BASE64_ALPHABET_XML, result);
+    return result;
 }
 
 std::string decodeString(const std::string &theS) {
     std::string result;
-    for (size_t i = 1; i < theS.size(); ++i) {
-        if (theS[i] == '-') {
-            result.push_back('+');
-        } else if (theS[i] == '.') {
-            result.push_back('/');
-        } else if (theS[i] == '_') {
-            result.push_back('=');
-        } else {
-            result.push_back(theS[i]);
-        }
+    if (theS.size() > 1) {
+        // Skip the prefix.
+        base64_decode(theS.data() + 1, theS.size() - 1, BASE64_ALPHABET_XML, result);
     }
-    result = base64_decode(result);
 //    std::cout << "Decode was: \"" << theS << "\" now \"" << result << "\"" << std::endl;
     // This does not work, see the pbXmlWrite.cpp decodeString for the solution.
     // return py::bytes(result);
@@ -61,134 +39,191 @@ std::string nameFromString(const std::string &theStr) {
     return encodeString(theStr, "Z");
 }
 
-XmlStream::XmlStream(const std::string &theEnc/* ='utf-8'*/,
-              const std::string &theDtdLocal /* =None */,
-              int theId /* =0 */,
-              bool mustIndent /* =True */) : encodeing(theEnc),
-                                             dtdLocal(theDtdLocal),
-                                             _mustIndent(mustIndent),
-                                             _intId(theId),
-                                             _inElem(false) {}
+template <typename Output, typename Indent, typename Escape, typename Check>
+BasicXmlStream<Output, Indent, Escape, Check>::BasicXmlStream(const std::string &theEnc/* ='utf-8'*/,
+                                                const std::string &theDtdLocal /* =None */,
+                                                int theId /* =0 */,
+                                                bool mustIndent /* =True */,
+                                                std::unique_ptr<XmlSink> theSink,
+                                                size_t theFlushSize,
+                                                size_t theSizeHint,
+                                                const std::string &theProfile) : m_output(std::move(theSink),
+                                                                                          theFlushSize),
+                                                                                 encodeing(theEnc),
+                                                                                 dtdLocal(theDtdLocal),
+                                                                                 _intId(theId),
+                                                                                 _sortAttributes(true),
+                                                                                 _profile(theProfile),
+                                                                                 _inElem(false),
+                                                                                 _indenter(mustIndent) {
+    _reserve(theSizeHint);
+}
+
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::_reserve(size_t theSizeHint) {
+    if (m_output.hasSink()) {
+        // The buffer is bounded by the flush size.
+        return;
+    }
+    size_t size = _profile.empty() ? 0 : XmlSizeProfiles::expected(_profile);
+    if (theSizeHint > size) {
+        size = theSizeHint;
+    }
+    if (size > m_output.capacity()) {
+        m_output.reserve(size);
+    }
+}
+
+template <typename Output, typename Indent, typename Escape, typename Check>
+std::string BasicXmlStream<Output, Indent, Escape, Check>::getvalue() const {
+    if (m_output.hasSink()) {
+        throw ExceptionXml("getvalue() is not available when writing to a sink");
+    }
+    return m_output.copy();
+}
 
-std::string XmlStream::getvalue() const {
+template <typename Output, typename Indent, typename Escape, typename Check>
+const std::string &BasicXmlStream<Output, Indent, Escape, Check>::getbuffer() {
+    if (m_output.hasSink()) {
+        throw ExceptionXml("getvalue() is not available when writing to a sink");
+    }
     return m_output.str();
 }
 
-std::string XmlStream::id() {
-    std::ostringstream out;
-    ++_intId;
-    return out.str();
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::writeTo(int fd) const {
+    if (m_output.hasSink()) {
+        throw ExceptionXml("writeTo() is not available when writing to a sink");
+    }
+    m_output.writeTo(fd);
 }
 
-bool XmlStream::_canIndent() const {
-    for (auto value: _canIndentStk) {
-        if (! value) {
-            return false;
-        }
+template <typename Output, typename Indent, typename Escape, typename Check>
+std::string BasicXmlStream<Output, Indent, Escape, Check>::drain() {
+    if (m_output.hasSink()) {
+        throw ExceptionXml("drain() is not available when writing to a sink");
     }
-    return true;
+    return m_output.take();
 }
 
-void XmlStream::_flipIndent(bool theBool) {
-    assert(_canIndentStk.size() > 0);
-    _canIndentStk[_canIndentStk.size() - 1] = theBool;
+template <typename Output, typename Indent, typename Escape, typename Check>
+std::string BasicXmlStream<Output, Indent, Escape, Check>::id() {
+    std::ostringstream out;
+    ++_intId;
+    return out.str();
 }
 
-void XmlStream::xmlSpacePreserve() {
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::xmlSpacePreserve() {
     _flipIndent(false);
 }
 
-void XmlStream::startElement(const std::string &name, const tAttrs &attrs) {
-//    std::cout << "XmlStream::startElement: " << name << std::endl;
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::startElement(XmlStringView name, const tAttrs &attrs) {
     _closeElemIfOpen();
-//    std::cout << "Help XmlStream::startElement: _indent()" << std::endl;
     _indent();
-//    std::cout << "Help XmlStream::startElement: m_output" << std::endl;
-    m_output << '<' << name;
-    std::string attribute_value;
-    bool use_attribute_value;
-    for (auto iter: attrs) {
-        m_output << ' ' << iter.first << '=' << "\"";
-        use_attribute_value = _encode(iter.second, attribute_value);
-        if (use_attribute_value) {
-            m_output << attribute_value;
-        } else {
-            m_output << iter.second;
-        }
-        m_output << "\"";
-    }
+    m_output << '<';
+    m_output.write(name.data(), name.size());
+    attrs.visit(_sortAttributes, [this](XmlStringView attr_name, XmlStringView attr_value) {
+        m_output << ' ';
+        m_output.write(attr_name.data(), attr_name.size());
+        m_output << "=\"";
+        _writeEncoded<Escape::ATTRIBUTE>(attr_value);
+        m_output << '"';
+    });
     _inElem = true;
-    _canIndentStk.push_back(_mustIndent);
-    _elemStk.push_back(name);
+    _indenter.push();
+    _elemStk.push_back(_names.intern(name));
 }
 
-void XmlStream::characters(const std::string &theString) {
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::characters(XmlStringView theString) {
     _closeElemIfOpen();
-    std::string encoded;
-    if (_encode(theString, encoded)) {
-        m_output << encoded;
-    } else {
-        m_output << theString;
-    }
+    _writeEncoded<Escape::TEXT>(theString);
     // mixed content - don't indent
     _flipIndent(false);
 }
 
-void XmlStream::literal(const std::string &theString) {
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::literal(XmlStringView theString) {
     _closeElemIfOpen();
-    m_output << theString;
+    m_output.write(theString.data(), theString.size());
     // mixed content - don't indent
     _flipIndent(false);
 }
 
-void XmlStream::comment(const std::string &theS, bool newLine) {
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::comment(XmlStringView theS, bool newLine) {
     _closeElemIfOpen();
     if (newLine) {
         _indent();
     }
-    std::string encoded;
-    if (_encode(theS, encoded)) {
-        m_output << "<!--" << encoded << "-->";
+    m_output << "<!--";
+    if (Escape::ESCAPE_COMMENT) {
+        _writeEncoded<Escape::TEXT>(theS);
     } else {
-        m_output << "<!--" << theS << "-->";
+        _writeComment(theS);
     }
+    m_output << "-->";
 }
 
-void XmlStream::pI(const std::string &theS) {
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::pI(XmlStringView theS) {
     _closeElemIfOpen();
-    std::string encoded;
-    if (_encode(theS, encoded)) {
-        m_output << "<?" << encoded << "?>";
-    } else {
-        m_output << "<?" << theS << "?>";
-    }
+    m_output << "<?";
+    _writeEncoded<Escape::TEXT>(theS);
+    m_output << "?>";
     // mixed content - don't indent
     _flipIndent(false);
 }
 
-void XmlStream::endElement(const std::string &name) {
-//    std::cout << "XmlStream::endElement: " << name << std::endl;
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::endElement(XmlStringView name) {
     if (_elemStk.size() == 0) {
         throw ExceptionXmlEndElement("endElement() on empty stack");
     }
-    if (name != _elemStk[_elemStk.size() - 1]) {
+    if (Check::CHECK && name != _names.name(_elemStk[_elemStk.size() - 1])) {
         std::ostringstream err;
-        err << "endElement(\"" << name << "\") does not match \"";
-        err << _elemStk[_elemStk.size() - 1] << "\"";
+        err << "endElement(\"" << name.str() << "\") does not match \"";
+        err << _names.name(_elemStk[_elemStk.size() - 1]).str() << "\"";
         throw ExceptionXmlEndElement(err.str());
     }
-    _elemStk.pop_back();
+    _endElementTop();
+}
+
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::_endElementAt(size_t depth) {
+    // The depth is checked by every policy, it is one comparison and
+    // without it a second _close() would silently close the parent.
+    if (depth == 0 || _elemStk.size() != depth) {
+        std::ostringstream err;
+        err << "Can not end the element at depth " << depth;
+        err << " when the depth is " << _elemStk.size();
+        if (_elemStk.size()) {
+            err << " (\"" << _names.name(_elemStk[_elemStk.size() - 1]).str() << "\")";
+        }
+        throw ExceptionXmlEndElement(err.str());
+    }
+    _endElementTop();
+}
+
+// End the innermost element, the stack must not be empty.
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::_endElementTop() {
+    assert(_elemStk.size() > 0);
     if (_inElem) {
         m_output << " />";
         _inElem = false;
     } else {
-        _indent();
-        m_output << "</" << name << '>';
+        _indent(1);
+        m_output << _names.endTag(_elemStk[_elemStk.size() - 1]);
     }
-    _canIndentStk.pop_back();
+    _elemStk.pop_back();
+    _indenter.pop();
 }
 
-void XmlStream::writeECMAScript(const std::string &theScript) {
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::writeECMAScript(XmlStringView theScript) {
     startElement("script",
                  {
                      std::pair<std::string, std::string>(
@@ -200,165 +235,229 @@ void XmlStream::writeECMAScript(const std::string &theScript) {
     endElement("script");
 }
 
-void XmlStream::writeCDATA(const std::string &theData) {
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::writeCDATA(XmlStringView theData) {
     _closeElemIfOpen();
     xmlSpacePreserve();
-//    m_output << '';
     m_output << "\n<![CDATA[\n";
-    m_output << theData;
+    m_output.write(theData.data(), theData.size());
     m_output << "\n]]>\n";
 }
 
-void XmlStream::writeCSS(const std::map<std::string, tAttrs> &theCSSMap) {
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::writeCSS(const std::map<std::string, tAttrs> &theCSSMap) {
 
-    startElement("style",
-                 {
-                     std::pair<std::string, std::string>("type", "text/css")
-                 });
-    for(auto style_map: theCSSMap) {
+    startElement("style", { { "type", "text/css" } });
+    for(const auto &style_map: theCSSMap) {
         m_output << style_map.first << " {\n";
-        for (auto attr_value: style_map.second) {
-            m_output << attr_value.first << " : " << attr_value.second << ";\n";
-        }
+        style_map.second.visit(true, [this](XmlStringView attr_name, XmlStringView attr_value) {
+            m_output.write(attr_name.data(), attr_name.size());
+            m_output << " : ";
+            m_output.write(attr_value.data(), attr_value.size());
+            m_output << ";\n";
+        });
         m_output << "}\n";
     }
     endElement("style");
 }
 
-void XmlStream::_indent(size_t offset) {
-    if (_canIndent()) {
-        m_output << '\n';
-        while(offset < _elemStk.size()) {
-            m_output << INDENT_STR;
-            ++offset;
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::execute(const XmlCommandBuffer &theCommands) {
+    XmlCommandBuffer::Executing executing(theCommands);
+    tAttrs attrs;
+    for (const auto &op: theCommands.ops()) {
+        switch (op.code) {
+            case XmlCommandBuffer::OP_START:
+                theCommands.attributes(op, attrs);
+                startElement(theCommands.name(op.name), attrs);
+                break;
+            case XmlCommandBuffer::OP_TEXT:
+                characters(theCommands.text(op));
+                break;
+            case XmlCommandBuffer::OP_END:
+                _endElementAt(_elemStk.size());
+                break;
         }
     }
 }
 
-void XmlStream::_closeElemIfOpen() {
-    if (_inElem) {
-        m_output << '>';
-        _inElem = false;
+// Encode the input to the output
+// Returns true if output must be used else the input can be used directly.
+template <typename Output, typename Indent, typename Escape, typename Check>
+bool BasicXmlStream<Output, Indent, Escape, Check>::_encode(const std::string &input,
+                                                   std::string &output) const {
+    output.clear();
+    const char *data = input.data();
+    size_t len = input.size();
+    size_t index_current = xml_escape_find(data, len);
+    if (index_current == len) {
+        return false;
+    }
+    output.reserve(len * 2);
+    size_t index_start = 0;
+    while (index_current < len) {
+        size_t entity_len;
+        const char *entity = xml_escape_entity(data[index_current], entity_len);
+        // Bulk copy of the clean run then the entity.
+        output.append(data + index_start, index_current - index_start);
+        output.append(entity, entity_len);
+        index_start = index_current + 1;
+        index_current = index_start + xml_escape_find(data + index_start,
+                                                      len - index_start);
     }
+    output.append(data + index_start, len - index_start);
+    return true;
 }
 
-void XmlStream::_write_to_output(const std::string &input,
-                                 std::string &output,
-                                 const std::string &subst,
-                                 size_t &index_start,
-                                 size_t index_current
-                                 ) const {
-    if (output.size() == 0) {
-        output.reserve(input.size() * 2);
+template <typename Output, typename Indent, typename Escape, typename Check>
+template <XmlEscapeContext C>
+void BasicXmlStream<Output, Indent, Escape, Check>::_writeEncoded(XmlStringView input) {
+    const char *data = input.data();
+    size_t len = input.size();
+    size_t index_start = 0;
+    size_t index_current = xml_escape_find<C>(data, len);
+    while (index_current < len) {
+        size_t entity_len;
+        const char *entity = xml_escape_entity(data[index_current], entity_len);
+        m_output.write(data + index_start, index_current - index_start);
+        m_output.write(entity, entity_len);
+        index_start = index_current + 1;
+        index_current = index_start + xml_escape_find<C>(data + index_start,
+                                                         len - index_start);
     }
-    output.append(input, index_start, index_current - index_start);
-    output.append(subst);
-    index_start = index_current + 1;
+    // The common case, nothing to escape, is a single write.
+    m_output.write(data + index_start, len - index_start);
 }
 
-// Encode the input to the output
-// Returns true if output must be used else the input can be used directly.
-bool XmlStream::_encode(const std::string &input,
-                        std::string &output) const {
-    output.clear();
-    bool use_original = true;
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::_writeComment(XmlStringView input) {
+    const char *data = input.data();
+    size_t len = input.size();
     size_t index_start = 0;
-    size_t index_current = 0;
-    
-    for (auto chr: input) {
-        switch (chr) {
-            case '<':
-                _write_to_output(input, output, "&lt;",
-                                 index_start, index_current);
-                use_original = false;
-                break;
-            case '>':
-                _write_to_output(input, output, "&gt;",
-                                 index_start, index_current);
-                use_original = false;
-                break;
-            case '&':
-                _write_to_output(input, output, "&amp;",
-                                 index_start, index_current);
-                use_original = false;
-                break;
-            case '\'':
-                _write_to_output(input, output, "&apos;",
-                                 index_start, index_current);
-                use_original = false;
-                break;
-            case '"':
-                _write_to_output(input, output, "&quot;",
-                                 index_start, index_current);
-                use_original = false;
-                break;
-            default:
-                if (! use_original) {
-                    output.push_back(chr);
-                    ++index_start;
-                }
-                break;
+    size_t index_search = 0;
+    const void *found;
+    while ((found = std::memchr(data + index_search, '-', len - index_search))) {
+        size_t index = static_cast<const char *>(found) - data;
+        if (index + 1 == len || data[index + 1] == '-') {
+            m_output.write(data + index_start, index + 1 - index_start);
+            m_output << ' ';
+            index_start = index + 1;
         }
-        ++index_current;
+        index_search = index + 1;
     }
-    return ! use_original;
+    m_output.write(data + index_start, len - index_start);
 }
 
-XmlStream &XmlStream::_enter() {
+template <typename Output, typename Indent, typename Escape, typename Check>
+BasicXmlStream<Output, Indent, Escape, Check> &BasicXmlStream<Output, Indent, Escape, Check>::_enter() {
     m_output << "<?xml version='1.0' encoding=\"" << encodeing << "\"?>";
     return *this;
 }
 
-//bool XmlStream::_exit(py::args args) {
-//    _close();
-//    return false; // Propogate any exception
-//}
-
-void XmlStream::_close() {
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::_close() {
     while (_elemStk.size()) {
-        endElement(_elemStk[_elemStk.size() - 1]);
+        _endElementTop();
     }
     m_output << '\n';
+    if (! _profile.empty() && ! m_output.hasSink()) {
+        // After a drain() this is only the remainder of the document.
+        XmlSizeProfiles::record(_profile, m_output.size());
+    }
+    m_output.close();
+}
+
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::reset(const std::string &theEnc,
+                                                          const std::string &theDtdLocal,
+                                                          int theId,
+                                                          bool mustIndent,
+                                                          std::unique_ptr<XmlSink> theSink,
+                                                          size_t theFlushSize,
+                                                          size_t theSizeHint,
+                                                          const std::string &theProfile) {
+    m_output.reset(std::move(theSink), theFlushSize);
+    encodeing = theEnc;
+    dtdLocal = theDtdLocal;
+    _intId = theId;
+    _sortAttributes = true;
+    _profile = theProfile;
+    _elemStk.clear();
+    _inElem = false;
+    _indenter.reset(mustIndent);
+    if (_names.size() > MAX_NAMES_KEPT) {
+        _names.clear();
+    }
+    _reserve(theSizeHint);
+}
+
+template <typename Output, typename Indent, typename Escape, typename Check>
+void BasicXmlStream<Output, Indent, Escape, Check>::reset() {
+    if (m_output.hasSink()) {
+        throw ExceptionXml("reset() is not available when writing to a sink");
+    }
+    reset(encodeing, dtdLocal, 0, _indenter.mustIndent(), nullptr,
+          XmlBuffer::DEFAULT_FLUSH_SIZE, 0, _profile);
 }
 
+template class BasicXmlStream<XmlBuffer, XmlIndentStack, XmlEscapeDefault, XmlCheckNames>;
+template class BasicXmlStream<XmlBuffer, XmlIndentNone, XmlEscapeByContext, XmlCheckNone>;
+
 /*************** XhtmlStream **************/
-XhtmlStream::XhtmlStream(const std::string &theEnc/* ='utf-8'*/,
-                         const std::string &theDtdLocal /* =None */,
-                         int theId /* =0 */,
-                         bool mustIndent /* =True */) : XmlStream(theEnc,
-                                                                  theDtdLocal,
-                                                                  theId,
-                                                                  mustIndent)
+const tAttrs XHTML_ROOT_ATTRIBUTES = {
+    { "xmlns", "http://www.w3.org/1999/xhtml"},
+    { "xml:lang", "en" },
+    { "lang" , "en" },
+};
+
+template <typename Stream>
+BasicXhtmlStream<Stream>::BasicXhtmlStream(const std::string &theEnc/* ='utf-8'*/,
+                                           const std::string &theDtdLocal /* =None */,
+                                           int theId /* =0 */,
+                                           bool mustIndent /* =True */,
+                                           std::unique_ptr<XmlSink> theSink,
+                                           size_t theFlushSize,
+                                           size_t theSizeHint,
+                                           const std::string &theProfile) : Stream(theEnc,
+                                                                                   theDtdLocal,
+                                                                                   theId,
+                                                                                   mustIndent,
+                                                                                   std::move(theSink),
+                                                                                   theFlushSize,
+                                                                                   theSizeHint,
+                                                                                   theProfile)
 {
 }
 
-XhtmlStream &XhtmlStream::_enter() {
-    XmlStream::_enter();
-    m_output << "\n<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\"";
-    m_output << " \"http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\">";
-    startElement("html", ROOT_ATTRIBUTES);
+template <typename Stream>
+BasicXhtmlStream<Stream> &BasicXhtmlStream<Stream>::_enter() {
+    Stream::_enter();
+    this->m_output << "\n<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\"";
+    this->m_output << " \"http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\">";
+    this->startElement("html", XHTML_ROOT_ATTRIBUTES);
     return *this;
 }
 
 // Writes the string replacing any ``\\n`` characters with ``<br/>`` elements.
-void XhtmlStream::charactersWithBr(const std::string &sIn) {
-    size_t index = 0;
-    while (index < sIn.size()) {
-        size_t found = sIn.find("\n", index);
-        if (found != std::string::npos) {
-            std::string slice(sIn, index, found - index);
-            characters(slice);
-            startElement("br", tAttrs());
-            endElement("br");
-            index = found + 1;
-        } else {
-            if (index < sIn.size()) {
-                std::string slice(sIn, index);
-                characters(slice);
-                break;
-            }
+template <typename Stream>
+void BasicXhtmlStream<Stream>::charactersWithBr(XmlStringView sIn) {
+    // Each line is written as a view of sIn, there are no copies.
+    const char *begin = sIn.data();
+    const char *end = begin + sIn.size();
+    while (begin < end) {
+        const char *found = static_cast<const char *>(std::memchr(begin, '\n', end - begin));
+        if (! found) {
+            this->characters(XmlStringView(begin, end - begin));
+            break;
         }
+        this->characters(XmlStringView(begin, found - begin));
+        this->startElement("br", tAttrs());
+        this->endElement("br");
+        begin = found + 1;
     }
 }
 
+template class BasicXhtmlStream<XmlStream>;
+template class BasicXhtmlStream<XmlStreamFast>;
+
 /*************** XhtmlStream **************/
@@ -12,10 +12,18 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 #include <sstream>
 
 #include <iostream>
 
+#include "XmlAttrs.h"
+#include "XmlCommandBuffer.h"
+#include "XmlEscape.h"
+#include "XmlNameTable.h"
+#include "XmlPolicies.h"
+#include "XmlSink.h"
+
 /**
  * This is pure C++ code but is designed to be specialised for a Python
  * interface. As such this has no dependencies on pybind11 or Python.h
@@ -51,115 +59,218 @@ std::string encodeString(const std::string &theS,
 std::string decodeString(const std::string &theS);
 std::string nameFromString(const std::string &theStr);
 
-using tAttrs = std::map<std::string, std::string>;
+using tAttrs = XmlAttrs;
 
 // Base stream class
-class XmlStream {
+// By default the document is accumulated in memory and retrieved with
+// getvalue(). If a sink is given the output is handed to the sink every
+// theFlushSize bytes and when the stream is closed.
+//
+// The behaviour is set at compile time by the policies in XmlPolicies.h:
+// Output is the buffer, XmlBuffer, Indent is XmlIndentStack or
+// XmlIndentNone, Escape is XmlEscapeByContext or XmlEscapeStrict and Check
+// is XmlCheckNames or XmlCheckNone.
+// The member functions are defined in XmlWrite.cpp and instantiated there
+// for XmlStream and XmlStreamFast below.
+template <typename Output, typename Indent, typename Escape, typename Check>
+class BasicXmlStream {
 public:
-    XmlStream(const std::string &theEnc/* ='utf-8'*/,
-              const std::string &theDtdLocal /* =None */,
-              int theId /* =0 */,
-              bool mustIndent /* =True */);
+    using tOutput = Output;
+
+    // For an in memory document theSizeHint is the expected size in bytes
+    // which is reserved up front. If theProfile is not empty the final size
+    // of the document is recorded under that key and later streams with the
+    // same key reserve for it, see XmlSizeProfiles.
+    BasicXmlStream(const std::string &theEnc/* ='utf-8'*/,
+                   const std::string &theDtdLocal /* =None */,
+                   int theId /* =0 */,
+                   bool mustIndent /* =True */,
+                   std::unique_ptr<XmlSink> theSink=nullptr,
+                   size_t theFlushSize=XmlBuffer::DEFAULT_FLUSH_SIZE,
+                   size_t theSizeHint=0,
+                   const std::string &theProfile=std::string());
+    // These raise an ExceptionXml if the stream is writing to a sink.
     std::string getvalue() const;
+    // The document without copying it, the output is joined into one string
+    // if necessary.
+    const std::string &getbuffer();
+    // Write the document to a file descriptor without joining the output.
+    void writeTo(int fd) const;
+    // Returns the output since the previous drain() and releases its memory.
+    // This can be called at any time, for example to send the document in
+    // chunks, the output may end part way through a start tag. Concatenating
+    // the results of every drain() gives the complete document.
+    std::string drain();
     std::string id();
-    bool _canIndent() const;
-    void _flipIndent(bool theBool);
+    bool _canIndent() const { return _indenter.canIndent(); }
+    void _flipIndent(bool theBool) { _indenter.flip(theBool); }
     void xmlSpacePreserve();
-    void startElement(const std::string &name, const tAttrs &attrs);
-    void characters(const std::string &theString);
-    void literal(const std::string &theString);
-    void comment(const std::string &theS, bool newLine=false);
-    void pI(const std::string &theS);
-    void endElement(const std::string &name);
-    void writeECMAScript(const std::string &theScript);
-    void writeCDATA(const std::string &theData);
+    // If true, the default, attributes are written sorted by name otherwise
+    // in the order they were added.
+    void sortAttributes(bool theBool) { _sortAttributes = theBool; }
+    bool sortAttributes() const { return _sortAttributes; }
+    void startElement(XmlStringView name, const tAttrs &attrs);
+    void characters(XmlStringView theString);
+    void literal(XmlStringView theString);
+    void comment(XmlStringView theS, bool newLine=false);
+    void pI(XmlStringView theS);
+    void endElement(XmlStringView name);
+    // The number of open elements.
+    size_t depth() const { return _elemStk.size(); }
+    // End the innermost element which must be at depth, this is the depth()
+    // after its startElement().
+    void _endElementAt(size_t depth);
+    void writeECMAScript(XmlStringView theScript);
+    void writeCDATA(XmlStringView theData);
     void writeCSS(const std::map<std::string, tAttrs> &theCSSMap);
-    void _indent(size_t offset=0);
-    void _closeElemIfOpen();
+    // Replay the operations recorded in theCommands. If this raises the
+    // operations before the failing one have been written.
+    void execute(const XmlCommandBuffer &theCommands);
+    // The string written once per level of indentation, the default is two
+    // spaces. For example "\t" or std::string(4, ' ').
+    void indentString(const std::string &theIndent) { _indenter.indentString(theIndent); }
+    const std::string &indentString() const { return _indenter.indentString(); }
+    void _indent(size_t offset=0) {
+        _indenter.write(m_output, offset < _elemStk.size() ? _elemStk.size() - offset : 0);
+    }
+    void _closeElemIfOpen() {
+        if (_inElem) {
+            m_output << '>';
+            _inElem = false;
+        }
+    }
 //    std::string _encode(const std::string &theStr) const;
     // Returns true if output contains the encode string otherwise use
     // input.
     bool _encode(const std::string &input, std::string &output) const;
-    XmlStream &_enter();
+    // Escape the input straight into the output, there is no temporary.
+    template <XmlEscapeContext C>
+    void _writeEncoded(XmlStringView input);
+    // Write the body of a comment, "--" is not allowed in a comment and it
+    // must not end with '-' so these are separated with a space.
+    void _writeComment(XmlStringView input);
+    BasicXmlStream &_enter();
     bool _exit() {
         _close();
         return false; // Propogate any exception
     }
     void _close();
-    std::ostringstream &output() { return m_output; }
+    // Discard the document and return to the state after construction with
+    // these arguments. The memory of the buffer, element stack and element
+    // names is kept so a reused stream does not allocate for a document no
+    // larger than the last one. The element names are discarded if there are
+    // more than MAX_NAMES_KEPT of them so that reusing a stream for documents
+    // with different names does not grow the table without limit.
+    void reset(const std::string &theEnc,
+               const std::string &theDtdLocal,
+               int theId,
+               bool mustIndent,
+               std::unique_ptr<XmlSink> theSink=nullptr,
+               size_t theFlushSize=XmlBuffer::DEFAULT_FLUSH_SIZE,
+               size_t theSizeHint=0,
+               const std::string &theProfile=std::string());
+    // As above keeping the current encoding, DTD, indentation and profile,
+    // the ID restarts at 0. Raises an ExceptionXml if the stream is writing
+    // to a sink.
+    void reset();
+    Output &output() { return m_output; }
+    // The number of distinct element names seen since the table was cleared.
+    size_t nameCount() const { return _names.size(); }
+    static const size_t MAX_NAMES_KEPT = 256;
 protected:
-    void _write_to_output(const std::string &input,
-                          std::string &output,
-                          const std::string &subst,
-                          size_t &index_start,
-                          size_t index_current
-                          ) const;
+    void _endElementTop();
+    // Reserve the larger of theSizeHint and the size for _profile.
+    void _reserve(size_t theSizeHint);
 protected:
-    std::ostringstream m_output;
+    Output m_output;
 public:
     std::string encodeing;
     std::string dtdLocal;
-    bool _mustIndent;
 protected:
     int _intId;
+    bool _sortAttributes;
+    std::string _profile;
 public:
-    std::vector<std::string> _elemStk;
+    // IDs of the open element names in _names.
+    std::vector<XmlNameTable::tId> _elemStk;
     bool _inElem;
-    std::vector<bool> _canIndentStk;
 protected:
-    const std::string INDENT_STR = "  ";
-    const std::map<char, std::string> ENTITY_MAP = {
-        { '<',  "&lt;" },
-        { '>',  "&gt;" },
-        { '&',  "&amp;" },
-        { '\'',  "&apos;" },
-        { '"', "&quot;" }
-    };
+    Indent _indenter;
+    XmlNameTable _names;
 };
 
+// The original behaviour.
+using XmlStream = BasicXmlStream<XmlBuffer, XmlIndentStack, XmlEscapeDefault, XmlCheckNames>;
+// No indentation and no end element name checks.
+using XmlStreamFast = BasicXmlStream<XmlBuffer, XmlIndentNone, XmlEscapeByContext, XmlCheckNone>;
+
+extern template class BasicXmlStream<XmlBuffer, XmlIndentStack, XmlEscapeDefault, XmlCheckNames>;
+extern template class BasicXmlStream<XmlBuffer, XmlIndentNone, XmlEscapeByContext, XmlCheckNone>;
+
+// The attributes of the <html> element, shared by every XhtmlStream.
+extern const tAttrs XHTML_ROOT_ATTRIBUTES;
+
 // Specialisation of an XmlStream to handle XHTML.
-class XhtmlStream : public XmlStream {
+template <typename Stream>
+class BasicXhtmlStream : public Stream {
 public:
-    XhtmlStream(const std::string &theEnc/* ='utf-8'*/,
-                const std::string &theDtdLocal /* =None */,
-                int theId /* =0 */,
-                bool mustIndent /* =True */);
-    XhtmlStream &_enter();
-    void charactersWithBr(const std::string & sIn);
-protected:
-    const tAttrs ROOT_ATTRIBUTES = {
-        { "xmlns", "http://www.w3.org/1999/xhtml"},
-        { "xml:lang", "en" },
-        { "lang" , "en" },
-    };
+    BasicXhtmlStream(const std::string &theEnc/* ='utf-8'*/,
+                     const std::string &theDtdLocal /* =None */,
+                     int theId /* =0 */,
+                     bool mustIndent /* =True */,
+                     std::unique_ptr<XmlSink> theSink=nullptr,
+                     size_t theFlushSize=XmlBuffer::DEFAULT_FLUSH_SIZE,
+                     size_t theSizeHint=0,
+                     const std::string &theProfile=std::string());
+    BasicXhtmlStream &_enter();
+    void charactersWithBr(XmlStringView sIn);
 };
 
+using XhtmlStream = BasicXhtmlStream<XmlStream>;
+using XhtmlStreamFast = BasicXhtmlStream<XmlStreamFast>;
+
+extern template class BasicXhtmlStream<XmlStream>;
+extern template class BasicXhtmlStream<XmlStreamFast>;
+
 // An individual element.
-class Element {
+// The start tag is written by the constructor so the name and attributes
+// are only borrowed for the duration of that call, the element keeps just
+// the stream and its depth. For example:
+//
+//  Element p(xs, "p", attrs);
+//  xs.characters("Text");
+//  p._close();
+//
+// _enter() does nothing and is retained for compatibility with code written
+// for XmlWrite.py Element.
+template <typename Stream>
+class BasicElement {
 public:
-    Element(XmlStream &theXmlStream,
-            const std::string &theElemName,
-            const tAttrs &theAttrs=tAttrs()) : \
-                _stream(theXmlStream),
-                _name(theElemName),
-                _attrs(theAttrs) {
-        }
-    Element &_enter() {
-        _stream.startElement(_name, _attrs);
+    BasicElement(Stream &theXmlStream,
+                 XmlStringView theElemName,
+                 const tAttrs &theAttrs=tAttrs()) : _stream(theXmlStream) {
+        _stream.startElement(theElemName, theAttrs);
+        _depth = _stream.depth();
+    }
+    BasicElement &_enter() {
         return *this;
     }
     bool _exit() {
         _close();
         return false;
     }
+    // Raises an ExceptionXmlEndElement if this is not the innermost element
+    // or it has already been closed.
     void _close() {
-        _stream.endElement(_name);
+        _stream._endElementAt(_depth);
+        _depth = 0;
     }
 protected:
-    XmlStream &_stream;
-    // Making these const references causes a segfault
-    const std::string _name;
-    const tAttrs _attrs;
+    Stream &_stream;
+    size_t _depth;
 };
 
+using Element = BasicElement<XmlStream>;
+using ElementFast = BasicElement<XmlStreamFast>;
+
 #endif /* XmlWrite_h */
@@ -38,101 +38,119 @@
  */
 
 #include "base64.h"
-#include <iostream>
 
-static const std::string base64_chars =
+/*
+ * Altered source version: rewritten as a table driven codec that writes
+ * directly into a presized output and supports an alternative alphabet, the
+ * original decoder searched base64_chars for every character.
+ */
+
+const char BASE64_ALPHABET_STANDARD[] =
 "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
 "abcdefghijklmnopqrstuvwxyz"
-"0123456789+/";
+"0123456789+/=";
 
+const char BASE64_ALPHABET_XML[] =
+"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+"abcdefghijklmnopqrstuvwxyz"
+"0123456789-._";
 
-static inline bool is_base64(unsigned char c) {
-    return (isalnum(c) || (c == '+') || (c == '/'));
-}
+static const unsigned char DECODE_INVALID = 0xFF;
 
-void base64_encode(const std::string &bytes_to_encode, std::string &output) {
-    int i = 0;
-    int j = 0;
-    size_t index = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-    
-    while (index < bytes_to_encode.size()) {
-        char_array_3[i++] = bytes_to_encode[index++];
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-            
-            for(i = 0; (i <4) ; i++)
-                output += base64_chars[char_array_4[i]];
-            i = 0;
+// Maps a character to its 6 bit value or DECODE_INVALID, this includes the
+// pad character.
+struct Base64DecodeTable {
+    explicit Base64DecodeTable(const char *alphabet) {
+        for (size_t i = 0; i < 256; ++i) {
+            value[i] = DECODE_INVALID;
         }
+        for (size_t i = 0; i < 64; ++i) {
+            value[static_cast<unsigned char>(alphabet[i])] = static_cast<unsigned char>(i);
+        }
+    }
+    unsigned char value[256];
+};
+
+static const Base64DecodeTable DECODE_STANDARD(BASE64_ALPHABET_STANDARD);
+static const Base64DecodeTable DECODE_XML(BASE64_ALPHABET_XML);
+
+void base64_encode(const char *data, size_t len, const char *alphabet,
+                   std::string &output) {
+    const unsigned char *in = reinterpret_cast<const unsigned char *>(data);
+    size_t offset = output.size();
+    output.resize(offset + 4 * ((len + 2) / 3));
+    char *out = &output[offset];
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3) {
+        unsigned int triple = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+        *out++ = alphabet[(triple >> 18) & 0x3F];
+        *out++ = alphabet[(triple >> 12) & 0x3F];
+        *out++ = alphabet[(triple >> 6) & 0x3F];
+        *out++ = alphabet[triple & 0x3F];
     }
-    
-    if (i)
-    {
-        for(j = i; j < 3; j++)
-            char_array_3[j] = '\0';
-        
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-        char_array_4[3] = char_array_3[2] & 0x3f;
-        
-        for (j = 0; (j < i + 1); j++)
-            output += base64_chars[char_array_4[j]];
-        
-        while((i++ < 3))
-            output += '=';
-        
+    if (i < len) {
+        unsigned int triple = in[i] << 16;
+        if (i + 1 < len) {
+            triple |= in[i + 1] << 8;
+        }
+        *out++ = alphabet[(triple >> 18) & 0x3F];
+        *out++ = alphabet[(triple >> 12) & 0x3F];
+        *out++ = (i + 1 < len) ? alphabet[(triple >> 6) & 0x3F] : alphabet[64];
+        *out++ = alphabet[64];
     }
 }
 
+void base64_encode(const std::string &bytes_to_encode, std::string &output) {
+    base64_encode(bytes_to_encode.data(), bytes_to_encode.size(),
+                  BASE64_ALPHABET_STANDARD, output);
+}
+
 std::string base64_encode(const std::string &bytes_to_encode) {
     std::string ret;
     base64_encode(bytes_to_encode, ret);
     return ret;
 }
 
-std::string base64_decode(std::string const& encoded_string) {
-    int in_len = encoded_string.size();
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::string ret;
-    
-    while (in_len-- && ( encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-        char_array_4[i++] = encoded_string[in_]; in_++;
-        if (i ==4) {
-            for (i = 0; i <4; i++)
-                char_array_4[i] = base64_chars.find(char_array_4[i]);
-            
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-            
-            for (i = 0; (i < 3); i++)
-                ret += char_array_3[i];
-            i = 0;
-        }
+void base64_decode(const char *data, size_t len, const char *alphabet,
+                   std::string &output) {
+    const unsigned char *table;
+    if (alphabet == BASE64_ALPHABET_XML) {
+        table = DECODE_XML.value;
+    } else {
+        table = DECODE_STANDARD.value;
+    }
+    const unsigned char *in = reinterpret_cast<const unsigned char *>(data);
+    // As the original decoding stops at the first pad or invalid character.
+    size_t valid = 0;
+    while (valid < len && table[in[valid]] < 64) {
+        ++valid;
     }
-    
-    if (i) {
-        for (j = i; j <4; j++)
-            char_array_4[j] = 0;
-        
-        for (j = 0; j <4; j++)
-            char_array_4[j] = base64_chars.find(char_array_4[j]);
-        
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-        
-        for (j = 0; (j < i - 1); j++) ret += char_array_3[j];
+    size_t offset = output.size();
+    output.resize(offset + (valid / 4) * 3 + (valid % 4 ? valid % 4 - 1 : 0));
+    char *out = &output[offset];
+    size_t i = 0;
+    for (; i + 4 <= valid; i += 4) {
+        unsigned int quad = (table[in[i]] << 18) | (table[in[i + 1]] << 12) |
+                            (table[in[i + 2]] << 6) | table[in[i + 3]];
+        *out++ = static_cast<char>(quad >> 16);
+        *out++ = static_cast<char>(quad >> 8);
+        *out++ = static_cast<char>(quad);
     }
-    
+    size_t remain = valid - i;
+    if (remain) {
+        unsigned int quad = table[in[i]] << 18;
+        for (size_t j = 1; j < remain; ++j) {
+            quad |= table[in[i + j]] << (18 - 6 * j);
+        }
+        for (size_t j = 0; j + 1 < remain; ++j) {
+            *out++ = static_cast<char>(quad >> (16 - 8 * j));
+        }
+    }
+}
+
+std::string base64_decode(std::string const& encoded_string) {
+    std::string ret;
+    base64_decode(encoded_string.data(), encoded_string.size(),
+                  BASE64_ALPHABET_STANDARD, ret);
     return ret;
 }
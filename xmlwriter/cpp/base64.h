@@ -16,6 +16,21 @@
 
 #include <string>
 
+// 64 characters followed by the pad character.
+extern const char BASE64_ALPHABET_STANDARD[];
+// The alphabet used by encodeString(), "+/=" are replaced by "-._" so that
+// the result can be used as an XML ID.
+extern const char BASE64_ALPHABET_XML[];
+
+// Append the encoding of len bytes of data to output. alphabet is one of
+// the above.
+void base64_encode(const char *data, size_t len, const char *alphabet,
+                   std::string &output);
+// Append the decoding of len characters of data to output. Decoding stops
+// at the first pad or character not in the alphabet.
+void base64_decode(const char *data, size_t len, const char *alphabet,
+                   std::string &output);
+
 void base64_encode(const std::string &bytes_to_encode, std::string &output);
 std::string base64_encode(const std::string &bytes_to_encode);
 std::string base64_decode(std::string const& s);
@@ -6,17 +6,373 @@
 //  Copyright © 2017 Paul Ross. All rights reserved.
 //
 
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <chrono>
+#include <thread>
+
+#include <cstring>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "XmlWrite.h"
+#include "XmlEscape.h"
+#include "XmlSinkZlib.h"
 
 #include "TestCPythonUtils.h"
 
+// The reference for xml_escape_find(), the index of the first of chars in
+// data or len.
+static size_t _escape_find_reference(const char *chars, const char *data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        if (data[i] && std::strchr(chars, data[i])) {
+            return i;
+        }
+    }
+    return len;
+}
+
+// Check a scanner for every length up to 70, at four alignments, with each
+// character at every position, in particular around the 16 and 32 byte
+// boundaries of the SIMD kernels. The filler includes bytes >= 0x80 and the
+// characters that are not escaped in this context.
+template <XmlEscapeContext C>
+int _test_xml_escape_find(const char *scanner, const char *chars) {
+    const char *all_chars = "<>&'\"";
+    char buffer[128];
+    for (size_t offset = 0; offset < 4; ++offset) {
+        char *data = buffer + offset;
+        for (size_t len = 0; len <= 70; ++len) {
+            for (size_t i = 0; i < len; ++i) {
+                // Not escaped in any context.
+                data[i] = "a\xc3\xa9 z;]"[i % 7];
+            }
+            if (xml_escape_find_with<C>(scanner, data, len) != len) {
+                return 1;
+            }
+            for (size_t pos = 0; pos < len; ++pos) {
+                for (const char *c = all_chars; *c; ++c) {
+                    data[pos] = *c;
+                    size_t expected = _escape_find_reference(chars, data, len);
+                    if (xml_escape_find_with<C>(scanner, data, len) != expected) {
+                        return 1;
+                    }
+                    // With a second character later on the first is found.
+                    if (pos + 1 < len) {
+                        char saved = data[len - 1];
+                        data[len - 1] = chars[0];
+                        expected = _escape_find_reference(chars, data, len);
+                        if (xml_escape_find_with<C>(scanner, data, len) != expected) {
+                            return 1;
+                        }
+                        data[len - 1] = saved;
+                    }
+                }
+                data[pos] = "a\xc3\xa9 z;]"[pos % 7];
+            }
+        }
+    }
+    return 0;
+}
+
+int test_xml_escape_find() {
+    int result = 0;
+    const char *names[8];
+    size_t count = xml_escape_scanner_names(names, 8);
+    for (size_t i = 0; i < count; ++i) {
+        int failure = 0;
+        failure |= _test_xml_escape_find<XML_ESCAPE_ALL>(names[i], "<>&'\"");
+        failure |= _test_xml_escape_find<XML_ESCAPE_TEXT>(names[i], "<>&");
+        failure |= _test_xml_escape_find<XML_ESCAPE_ATTRIBUTE>(names[i], "<&\"");
+        std::cout << std::setw(50) << __FUNCTION__ << " " << std::setw(6) << names[i];
+        std::cout << " result: " << failure << std::endl;
+        result |= failure;
+    }
+    return result;
+}
+
+// A second _close() raises rather than closing the parent, for every policy.
+template <typename Stream>
+int _test_element_close_twice_raises() {
+    int result = 0;
+    Stream xs { "utf-8", "", 0, true };
+    try {
+        xs._enter();
+        BasicElement<Stream> root(xs, "root");
+        BasicElement<Stream> p(xs, "p");
+        p._close();
+        try {
+            p._close();
+            result |= 1;
+        } catch (ExceptionXmlEndElement &) {
+        }
+        result |= xs.depth() != 1;
+        root._close();
+        xs._close();
+    } catch (ExceptionXml &) {
+        result |= 1;
+    }
+    return result;
+}
+
+int test_element_close_twice_raises() {
+    int result = 0;
+    result |= _test_element_close_twice_raises<XmlStream>();
+    result |= _test_element_close_twice_raises<XmlStreamFast>();
+    std::cout << std::setw(50) << __FUNCTION__ << " result: " << result << std::endl;
+    return result;
+}
+
+// A reused stream keeps up to MAX_NAMES_KEPT element names, beyond that
+// reset() discards them and the names of the next document still match.
+int test_reset_name_table() {
+    int result = 0;
+    XmlStream xs { "utf-8", "", 0, false };
+    const size_t count = XmlStream::MAX_NAMES_KEPT + 1;
+    for (int doc = 0; doc < 3; ++doc) {
+        try {
+            xs._enter();
+            for (size_t i = 0; i < count; ++i) {
+                std::string name = "e" + std::to_string(doc) + "_" + std::to_string(i);
+                xs.startElement(name, tAttrs());
+                xs.endElement(name);
+            }
+            xs._close();
+        } catch (ExceptionXml &) {
+            result |= 1;
+        }
+        result |= xs.nameCount() != count;
+        std::string last = "<e" + std::to_string(doc) + "_" + std::to_string(count - 1) + " />";
+        result |= xs.getvalue().find(last) == std::string::npos;
+        xs.reset();
+        result |= xs.nameCount() != 0;
+    }
+    std::cout << std::setw(50) << __FUNCTION__ << " result: " << result << std::endl;
+    return result;
+}
+
+// With sortAttributes(false) the attributes are written in the order they
+// were added, reset() restores sorting by name.
+template <typename Stream>
+int _test_sort_attributes_off() {
+    int result = 0;
+    Stream xs { "utf-8", "", 0, false };
+    result |= ! xs.sortAttributes();
+    xs.sortAttributes(false);
+    try {
+        xs._enter();
+        xs.startElement("A", { {"z", "1"}, {"b", "2"}, {"m", "3"} });
+        xs.endElement("A");
+        xs._close();
+    } catch (ExceptionXml &) {
+        result |= 1;
+    }
+    result |= xs.getvalue().find("<A z=\"1\" b=\"2\" m=\"3\" />") == std::string::npos;
+    xs.reset();
+    result |= ! xs.sortAttributes();
+    try {
+        xs._enter();
+        xs.startElement("A", { {"z", "1"}, {"b", "2"}, {"m", "3"} });
+        xs.endElement("A");
+        xs._close();
+    } catch (ExceptionXml &) {
+        result |= 1;
+    }
+    result |= xs.getvalue().find("<A b=\"2\" m=\"3\" z=\"1\" />") == std::string::npos;
+    return result;
+}
+
+int test_sort_attributes_off() {
+    int result = 0;
+    result |= _test_sort_attributes_off<XmlStream>();
+    result |= _test_sort_attributes_off<XmlStreamFast>();
+    std::cout << std::setw(50) << __FUNCTION__ << " result: " << result << std::endl;
+    return result;
+}
+
+// The old _indent(), a newline then the unit once per level.
+static std::string _indent_reference(const std::string &unit, size_t levels) {
+    std::string result = "\n";
+    for (size_t i = 0; i < levels; ++i) {
+        result += unit;
+    }
+    return result;
+}
+
+// Exposes the protected state of XmlIndentStack and records the writes.
+class _XmlIndentStackProbe : public XmlIndentStack {
+public:
+    explicit _XmlIndentStackProbe(bool mustIndent) : XmlIndentStack(mustIndent) {}
+    size_t noIndentCount() const { return _noIndentCount; }
+    size_t bufferSize() const { return _indentBuffer.size(); }
+    void write(size_t levels) {
+        XmlIndentStack::write(*this, levels);
+    }
+    void write(const char *data, size_t len) {
+        written.append(data, len);
+        ++writes;
+    }
+    std::string written;
+    size_t writes = 0;
+};
+
+// Each indent is one write that matches the old per-level loop for any unit.
+// The cached buffer only grows when a deeper level is first reached.
+int test_indent_string_write() {
+    int result = 0;
+    const std::string units[] = { "  ", "\t", std::string(4, ' ') };
+    const size_t levels[] = { 0, 1, 5, 3, 40, 2, 41, 0, 200, 7 };
+    for (const std::string &unit: units) {
+        _XmlIndentStackProbe indent(true);
+        indent.indentString(unit);
+        result |= indent.indentString() != unit;
+        size_t deepest = 0;
+        for (size_t level: levels) {
+            indent.written.clear();
+            indent.writes = 0;
+            indent.write(level);
+            result |= indent.written != _indent_reference(unit, level);
+            result |= indent.writes != 1;
+            deepest = std::max(deepest, level);
+            result |= indent.bufferSize() != 1 + deepest * unit.size();
+        }
+    }
+    std::cout << std::setw(50) << __FUNCTION__ << " result: " << result << std::endl;
+    return result;
+}
+
+// reset() restores two spaces and the cached buffer is rebuilt for them.
+int test_indent_string_reset() {
+    int result = 0;
+    _XmlIndentStackProbe indent(true);
+    indent.indentString("\t");
+    indent.write(6);
+    indent.push();
+    indent.flip(false);
+    indent.reset(true);
+    result |= indent.indentString() != "  ";
+    result |= indent.noIndentCount() != 0;
+    result |= ! indent.canIndent();
+    indent.written.clear();
+    indent.write(3);
+    result |= indent.written != _indent_reference("  ", 3);
+    result |= indent.bufferSize() != 1 + 3 * 2;
+    std::cout << std::setw(50) << __FUNCTION__ << " result: " << result << std::endl;
+    return result;
+}
+
+// The count of frames that can not be indented follows push(), pop() and
+// repeated flip() of the same frame.
+int test_indent_no_indent_count() {
+    int result = 0;
+    _XmlIndentStackProbe indent(true);
+    indent.flip(false); // No frame, ignored.
+    result |= indent.noIndentCount() != 0;
+    indent.push();
+    indent.push();
+    indent.flip(false);
+    indent.flip(false);
+    result |= indent.noIndentCount() != 1;
+    indent.push();
+    indent.flip(false);
+    result |= indent.noIndentCount() != 2;
+    indent.flip(true);
+    indent.flip(true);
+    result |= indent.noIndentCount() != 1;
+    result |= indent.canIndent();
+    indent.pop();
+    indent.pop();
+    result |= indent.noIndentCount() != 0;
+    result |= ! indent.canIndent();
+    indent.written.clear();
+    indent.write(1);
+    result |= indent.written != "\n  ";
+    indent.flip(false);
+    indent.written.clear();
+    indent.write(1);
+    result |= ! indent.written.empty();
+    indent.pop();
+    result |= indent.noIndentCount() != 0;
+    // With mustIndent false every frame counts.
+    _XmlIndentStackProbe no_indent(false);
+    no_indent.push();
+    no_indent.push();
+    result |= no_indent.noIndentCount() != 2;
+    no_indent.flip(true);
+    result |= no_indent.noIndentCount() != 1;
+    no_indent.pop();
+    no_indent.pop();
+    result |= no_indent.noIndentCount() != 0;
+    std::cout << std::setw(50) << __FUNCTION__ << " result: " << result << std::endl;
+    return result;
+}
+
+// A deeply nested document written with a tab and a four space unit
+// matches the old per-level loop. xmlSpacePreserve() and _flipIndent()
+// stop indentation only inside their element.
+int test_indent_string_stream() {
+    int result = 0;
+    const std::string units[] = { "\t", std::string(4, ' ') };
+    const size_t depth = 100;
+    for (const std::string &unit: units) {
+        XmlStream xs { "utf-8", "", 0, true };
+        xs.indentString(unit);
+        std::string expected = "<?xml version='1.0' encoding=\"utf-8\"?>";
+        try {
+            xs._enter();
+            for (size_t i = 0; i < depth; ++i) {
+                std::string name = "e" + std::to_string(i);
+                xs.startElement(name, tAttrs());
+                expected += _indent_reference(unit, i) + "<" + name;
+                expected += i + 1 < depth ? ">" : " />";
+            }
+            for (size_t i = depth; i-- > 0;) {
+                xs.endElement("e" + std::to_string(i));
+                if (i + 1 < depth) {
+                    expected += _indent_reference(unit, i) + "</e" + std::to_string(i) + ">";
+                }
+            }
+            xs.startElement("p", tAttrs());
+            xs.xmlSpacePreserve();
+            result |= xs._canIndent();
+            xs.startElement("q", tAttrs());
+            xs.endElement("q");
+            xs.endElement("p");
+            result |= ! xs._canIndent();
+            xs.startElement("r", tAttrs());
+            xs.startElement("s", tAttrs());
+            xs._flipIndent(false);
+            xs._flipIndent(false);
+            xs.endElement("s");
+            xs.endElement("r");
+            result |= ! xs._canIndent();
+            xs.startElement("t", tAttrs());
+            xs.endElement("t");
+            xs._close();
+        } catch (ExceptionXml &) {
+            result |= 1;
+        }
+        expected += "\n<p><q /></p>\n<r>" + _indent_reference(unit, 1) + "<s />\n</r>\n<t />\n";
+        result |= xs.getvalue() != expected;
+    }
+    std::cout << std::setw(50) << __FUNCTION__ << " result: " << result << std::endl;
+    return result;
+}
+
 int test_all() {
     int result = 0;
     result |= test_all_cpython_utils();
+    result |= test_xml_escape_find();
+    result |= test_element_close_twice_raises();
+    result |= test_reset_name_table();
+    result |= test_sort_attributes_off();
+    result |= test_indent_string_write();
+    result |= test_indent_string_reset();
+    result |= test_indent_no_indent_count();
+    result |= test_indent_string_stream();
     return result;
 }
 
@@ -78,9 +434,12 @@ void test_XmlWrite__encode_no_encoding() {
     for (size_t i = 0; i < COUNT; ++i) {
         xs._encode(text_no_encoding, output);
     }
+    double us = clk.us();
     std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
     std::cout << std::setw(12) << std::fixed << std::setprecision(3);
-    std::cout << clk.us() / COUNT << " (us)";
+    std::cout << us / COUNT << " (us)";
+    std::cout << " rate: " << std::setw(12) << text_no_encoding.size() * COUNT / us << " (MB/s)";
+    std::cout << " scanner: " << xml_escape_scanner_name();
     std::cout << std::endl;
 }
 
@@ -94,9 +453,12 @@ void test_XmlWrite__encode_with_encoding() {
     for (size_t i = 0; i < COUNT; ++i) {
         xs._encode(text_requires_encoding, output);
     }
+    double us = clk.us();
     std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
     std::cout << std::setw(12) << std::fixed << std::setprecision(3);
-    std::cout << clk.us() / COUNT << " (us)";
+    std::cout << us / COUNT << " (us)";
+    std::cout << " rate: " << std::setw(12) << text_requires_encoding.size() * COUNT / us << " (MB/s)";
+    std::cout << " scanner: " << xml_escape_scanner_name();
     std::cout << std::endl;
 }
 
@@ -129,34 +491,97 @@ void test_XmlWrite_decodeString() {
     std::cout << std::endl;
 }
 
-// Simulate writing an XHTML document
-double _test_write_XHTML_document(size_t headings, size_t paragraphs,
-                                  size_t &size, size_t repeat, const tAttrs &attributes) {
+// Write a small document to the stream.
+template <typename Stream>
+void _write_two_elements(Stream &xs) {
+    xs._enter();
+    xs.startElement("Root", { { "version", "12.0" } });
+    xs.startElement("A", { { "attr_1", "1" } });
+    xs.endElement("A");
+    xs.endElement("Root");
+    xs._close();
+}
+
+// Test performance of a new stream for each small document.
+void test_XmlWrite_create_stream() {
+    size_t COUNT = 100000;
+    size_t size = 0;
     ExecClock clk;
-    for (size_t i = 0; i < repeat; ++i) {
+
+    for (size_t i = 0; i < COUNT; ++i) {
         XhtmlStream xs { "utf-8", "", 0, true };
-        xs._enter();
-        for (size_t i_h1 = 0; i_h1 < headings; ++i_h1) {
-            Element h1 = Element(xs, "h1", attributes);
-            h1._enter();
-            for (size_t i_h2 = 0; i_h2 < headings; ++i_h2) {
-                Element h2 = Element(xs, "h2", attributes);
-                h2._enter();
-                for (size_t i_h3 = 0; i_h3 < headings; ++i_h3) {
-                    Element h3 = Element(xs, "h3", attributes);
-                    h3._enter();
-                    for (size_t t = 0; t < paragraphs; ++t) {
-                        Element p = Element(xs, "p", attributes);
-                        p._enter();
-                        xs.characters(text_no_encoding);
-                        p._close();
-                    }
-                    h3._close();
+        _write_two_elements(xs);
+        size += xs.getbuffer().size();
+    }
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << clk.us() / COUNT << " (us)" << " size: " << std::setw(12) << size / COUNT;
+    std::cout << std::endl;
+}
+
+// Test performance of reusing one stream for each small document.
+void test_XmlWrite_reset_stream() {
+    size_t COUNT = 100000;
+    size_t size = 0;
+    XhtmlStream xs { "utf-8", "", 0, true };
+    ExecClock clk;
+
+    for (size_t i = 0; i < COUNT; ++i) {
+        xs.reset();
+        _write_two_elements(xs);
+        size += xs.getbuffer().size();
+    }
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << clk.us() / COUNT << " (us)" << " size: " << std::setw(12) << size / COUNT;
+    std::cout << std::endl;
+}
+
+// Peak resident set size in kB, this is the maximum over the life of the process.
+long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+// Write the body of an XHTML document to the stream
+template <typename Stream>
+void _write_XHTML_document(Stream &xs, size_t headings, size_t paragraphs,
+                       const tAttrs &attributes) {
+    for (size_t i_h1 = 0; i_h1 < headings; ++i_h1) {
+        BasicElement<Stream> h1(xs, "h1", attributes);
+        for (size_t i_h2 = 0; i_h2 < headings; ++i_h2) {
+            BasicElement<Stream> h2(xs, "h2", attributes);
+            for (size_t i_h3 = 0; i_h3 < headings; ++i_h3) {
+                BasicElement<Stream> h3(xs, "h3", attributes);
+                for (size_t t = 0; t < paragraphs; ++t) {
+                    BasicElement<Stream> p(xs, "p", attributes);
+                    xs.characters(text_no_encoding);
+                    p._close();
                 }
-                h2._close();
+                h3._close();
             }
-            h1._close();
+            h2._close();
         }
+        h1._close();
+    }
+}
+
+// Simulate writing an XHTML document
+template <typename Stream=XhtmlStream>
+double _test_write_XHTML_document(size_t headings, size_t paragraphs,
+                                  size_t &size, size_t repeat, const tAttrs &attributes,
+                                  size_t sizeHint=0, const std::string &profile="") {
+    ExecClock clk;
+    for (size_t i = 0; i < repeat; ++i) {
+        Stream xs { "utf-8", "", 0, true, nullptr, XmlBuffer::DEFAULT_FLUSH_SIZE,
+            sizeHint, profile };
+        xs._enter();
+        _write_XHTML_document(xs, headings, paragraphs, attributes);
         xs._close();
         std::string result = xs.getvalue();
         size = result.size();
@@ -164,6 +589,129 @@ double _test_write_XHTML_document(size_t headings, size_t paragraphs,
     return clk.us() / repeat;
 }
 
+// Simulate writing an XHTML document to a temporary file, flushing every
+// flushSize bytes.
+double _test_write_XHTML_document_to_file(size_t headings, size_t paragraphs,
+                                          size_t &size, size_t repeat,
+                                          const tAttrs &attributes,
+                                          size_t flushSize) {
+    ExecClock clk;
+    for (size_t i = 0; i < repeat; ++i) {
+        char path[] = "/tmp/xmlwriter_XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            throw ExceptionXml("Can not create temporary file.");
+        }
+        unlink(path);
+        {
+            XhtmlStream xs { "utf-8", "", 0, true,
+                std::unique_ptr<XmlSink>(new XmlSinkFd(fd)), flushSize
+            };
+            xs._enter();
+            _write_XHTML_document(xs, headings, paragraphs, attributes);
+            xs._close();
+        }
+        struct stat file_stat;
+        fstat(fd, &file_stat);
+        size = static_cast<size_t>(file_stat.st_size);
+        close(fd);
+    }
+    return clk.us() / repeat;
+}
+
+// Simulate writing an XHTML document in memory then to a temporary file.
+double _test_write_XHTML_document_write_to(size_t headings, size_t paragraphs,
+                                           size_t &size, size_t repeat,
+                                           const tAttrs &attributes) {
+    ExecClock clk;
+    for (size_t i = 0; i < repeat; ++i) {
+        char path[] = "/tmp/xmlwriter_XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            throw ExceptionXml("Can not create temporary file.");
+        }
+        unlink(path);
+        {
+            XhtmlStream xs { "utf-8", "", 0, true };
+            xs._enter();
+            _write_XHTML_document(xs, headings, paragraphs, attributes);
+            xs._close();
+            xs.writeTo(fd);
+        }
+        struct stat file_stat;
+        fstat(fd, &file_stat);
+        size = static_cast<size_t>(file_stat.st_size);
+        close(fd);
+    }
+    return clk.us() / repeat;
+}
+
+// Simulate writing an XHTML document to a slow file system where each write
+// of a flushSize chunk takes delay_us, optionally with a writer thread.
+double _test_write_XHTML_document_slow_sink(size_t headings, size_t paragraphs,
+                                            size_t &size, size_t repeat,
+                                            const tAttrs &attributes,
+                                            size_t delay_us, bool background) {
+    ExecClock clk;
+    for (size_t i = 0; i < repeat; ++i) {
+        size = 0;
+        std::unique_ptr<XmlSink> sink(new XmlSinkCallback(
+            [&size, delay_us](const char * /* data */, size_t len) {
+                std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+                size += len;
+            }));
+        if (background) {
+            sink.reset(new XmlSinkThread(std::move(sink)));
+        }
+        XhtmlStream xs { "utf-8", "", 0, true, std::move(sink) };
+        xs._enter();
+        _write_XHTML_document(xs, headings, paragraphs, attributes);
+        xs._close();
+    }
+    return clk.us() / repeat;
+}
+
+// Simulate writing an XHTML document gzip compressed to a temporary file,
+// optionally compressing on a writer thread or on threads threads in
+// parallel. size is the compressed size.
+double _test_write_XHTML_document_gzip(size_t headings, size_t paragraphs,
+                                       size_t &size, size_t repeat,
+                                       const tAttrs &attributes,
+                                       int level, bool background,
+                                       size_t threads=1) {
+    ExecClock clk;
+    for (size_t i = 0; i < repeat; ++i) {
+        char path[] = "/tmp/xmlwriter_XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            throw ExceptionXml("Can not create temporary file.");
+        }
+        unlink(path);
+        {
+            std::unique_ptr<XmlSink> target(new XmlSinkFd(fd));
+            std::unique_ptr<XmlSink> sink;
+            if (threads == 1) {
+                sink.reset(new XmlSinkZlib(std::move(target), level));
+            } else {
+                sink.reset(new XmlSinkZlibParallel(std::move(target), level,
+                                                   XmlSinkZlib::FORMAT_GZIP, threads));
+            }
+            if (background) {
+                sink.reset(new XmlSinkThread(std::move(sink)));
+            }
+            XhtmlStream xs { "utf-8", "", 0, true, std::move(sink) };
+            xs._enter();
+            _write_XHTML_document(xs, headings, paragraphs, attributes);
+            xs._close();
+        }
+        struct stat file_stat;
+        fstat(fd, &file_stat);
+        size = static_cast<size_t>(file_stat.st_size);
+        close(fd);
+    }
+    return clk.us() / repeat;
+}
+
 void test_write_small_XHTML_document() {
     size_t size;
     tAttrs attributes;
@@ -197,6 +745,157 @@ void test_write_very_large_XHTML_document() {
     std::cout << std::endl;
 }
 
+// With the exact size reserved up front.
+void test_write_very_large_XHTML_document_size_hint() {
+    size_t size;
+    tAttrs attributes;
+    auto exec = _test_write_XHTML_document(16, 8, size, 4, attributes, 15205585);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << " result: " << (size == 15205585);
+    std::cout << std::endl;
+}
+
+// The size is learnt from the first document.
+void test_write_very_large_XHTML_document_profile() {
+    size_t size;
+    tAttrs attributes;
+    auto exec = _test_write_XHTML_document(16, 8, size, 4, attributes, 0, __FUNCTION__);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << " result: " << (size == 15205585);
+    std::cout << std::endl;
+}
+
+void test_write_large_XHTML_document_attributes_profile() {
+    size_t size;
+    auto exec = _test_write_XHTML_document(8, 5, size, 10, BENCHMARK_ATTRIBUTES, 0, __FUNCTION__);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << " result: " << (size == 1907185);
+    std::cout << std::endl;
+}
+
+void test_write_very_large_XHTML_document_attributes_profile() {
+    size_t size;
+    auto exec = _test_write_XHTML_document(16, 8, size, 4, BENCHMARK_ATTRIBUTES, 0, __FUNCTION__);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << " result: " << (size == 23635457);
+    std::cout << std::endl;
+}
+
+// XhtmlStreamFast does not indent so the document is smaller.
+void test_write_very_large_XHTML_document_fast() {
+    size_t size;
+    tAttrs attributes;
+    auto exec = _test_write_XHTML_document<XhtmlStreamFast>(16, 8, size, 4, attributes);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << std::endl;
+}
+
+void test_write_very_large_XHTML_document_to_file() {
+    size_t size;
+    tAttrs attributes;
+    long rss_before = peak_rss_kb();
+    auto exec = _test_write_XHTML_document_to_file(16, 8, size, 4, attributes,
+                                                   XmlBuffer::DEFAULT_FLUSH_SIZE);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << " result: " << (size == 15205585);
+    std::cout << " peak RSS growth: " << peak_rss_kb() - rss_before << " (kB)";
+    std::cout << std::endl;
+}
+
+void test_write_very_large_XHTML_document_write_to() {
+    size_t size;
+    tAttrs attributes;
+    long rss_before = peak_rss_kb();
+    auto exec = _test_write_XHTML_document_write_to(16, 8, size, 4, attributes);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << " result: " << (size == 15205585);
+    std::cout << " peak RSS growth: " << peak_rss_kb() - rss_before << " (kB)";
+    std::cout << std::endl;
+}
+
+void test_write_very_large_XHTML_document_slow_sink() {
+    size_t size;
+    tAttrs attributes;
+    auto exec = _test_write_XHTML_document_slow_sink(16, 8, size, 4, attributes, 10, false);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << " result: " << (size == 15205585);
+    std::cout << std::endl;
+}
+
+void test_write_very_large_XHTML_document_slow_sink_background() {
+    size_t size;
+    tAttrs attributes;
+    auto exec = _test_write_XHTML_document_slow_sink(16, 8, size, 4, attributes, 10, true);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << " result: " << (size == 15205585);
+    std::cout << std::endl;
+}
+
+void test_write_very_large_XHTML_document_gzip() {
+    size_t size;
+    tAttrs attributes;
+    long rss_before = peak_rss_kb();
+    auto exec = _test_write_XHTML_document_gzip(16, 8, size, 4, attributes,
+                                                Z_DEFAULT_COMPRESSION, false);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << " peak RSS growth: " << peak_rss_kb() - rss_before << " (kB)";
+    std::cout << std::endl;
+}
+
+void test_write_very_large_XHTML_document_gzip_fastest() {
+    size_t size;
+    tAttrs attributes;
+    auto exec = _test_write_XHTML_document_gzip(16, 8, size, 4, attributes, 1, false);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << std::endl;
+}
+
+void test_write_very_large_XHTML_document_gzip_background() {
+    size_t size;
+    tAttrs attributes;
+    auto exec = _test_write_XHTML_document_gzip(16, 8, size, 4, attributes,
+                                                Z_DEFAULT_COMPRESSION, true);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << std::endl;
+}
+
+// One compression thread per core.
+void test_write_very_large_XHTML_document_gzip_parallel() {
+    size_t size;
+    tAttrs attributes;
+    auto exec = _test_write_XHTML_document_gzip(16, 8, size, 4, attributes,
+                                                Z_DEFAULT_COMPRESSION, false, 0);
+    std::cout << std::setw(50) <<__FUNCTION__ << " time: ";
+    std::cout << std::setw(12) << std::fixed << std::setprecision(3);
+    std::cout << exec << " (us)" << " size: " << std::setw(12) << size;
+    std::cout << " threads: " << std::thread::hardware_concurrency();
+    std::cout << std::endl;
+}
+
 void test_write_small_XHTML_document_attributes() {
     size_t size;
     auto exec = _test_write_XHTML_document(4, 2, size, 100, BENCHMARK_ATTRIBUTES);
@@ -246,18 +945,35 @@ void debug_function() {
 }
 
 void run_performance_tests() {
+    // Run first so that the peak RSS is not dominated by the in memory tests.
+    test_write_very_large_XHTML_document_to_file();
+    test_write_very_large_XHTML_document_write_to();
+    test_write_very_large_XHTML_document_slow_sink();
+    test_write_very_large_XHTML_document_slow_sink_background();
+    test_write_very_large_XHTML_document_gzip();
+    test_write_very_large_XHTML_document_gzip_fastest();
+    test_write_very_large_XHTML_document_gzip_background();
+    test_write_very_large_XHTML_document_gzip_parallel();
+
     test_XmlWrite__encode_no_encoding();
     test_XmlWrite__encode_with_encoding();
     test_XmlWrite_encodeString();
     test_XmlWrite_decodeString();
+    test_XmlWrite_create_stream();
+    test_XmlWrite_reset_stream();
 
     test_write_small_XHTML_document();
     test_write_large_XHTML_document();
     test_write_very_large_XHTML_document();
+    test_write_very_large_XHTML_document_size_hint();
+    test_write_very_large_XHTML_document_profile();
+    test_write_very_large_XHTML_document_fast();
 
     test_write_small_XHTML_document_attributes();
     test_write_large_XHTML_document_attributes();
     test_write_very_large_XHTML_document_attributes();
+    test_write_large_XHTML_document_attributes_profile();
+    test_write_very_large_XHTML_document_attributes_profile();
 }
 
 int main(int /* argc */, const char *[] /* argv[] */) {
@@ -11,9 +11,9 @@
 #include <memory>
 
 #include "XmlWrite.h"
+#include "XmlSinkZlib.h"
 #include "XmlWrite_docs.h"
 #include "ConvertPyBytes.h"
-#include "ConvertPyDict.h"
 #include "ConvertPyStr.h"
 #include "DefaultArguments.h"
 
@@ -22,6 +22,19 @@
 static PyObject *Py_ExceptionXml;
 static PyObject *Py_ExceptionXmlEndElement;
 
+// The per element methods use METH_FASTCALL where available, and Element
+// construction vectorcall, so that no argument tuple or dict is built.
+#if PY_VERSION_HEX >= 0x03070000
+#define XML_WRITE_FASTCALL 1
+#define XML_WRITE_METH_KEYWORDS (METH_FASTCALL | METH_KEYWORDS)
+#define XML_WRITE_METH_EXIT METH_FASTCALL
+#else
+#define XML_WRITE_FASTCALL 0
+#define XML_WRITE_METH_KEYWORDS (METH_VARARGS | METH_KEYWORDS)
+#define XML_WRITE_METH_EXIT METH_VARARGS
+#endif
+#define XML_WRITE_VECTORCALL (PY_VERSION_HEX >= 0x03090000)
+
 #pragma mark -
 #pragma mark Encoding/decoding
 
@@ -136,9 +149,333 @@ finally:
     return ret;
 }
 
+#pragma mark -
+#pragma mark Exception translation
+
+/* Set a Python exception from a C++ ExceptionXml. If a Python exception is
+ * already set, for example by a failing sink, then that is retained.
+ */
+static void
+set_py_exception_from(const ExceptionXml &err) {
+    if (! PyErr_Occurred()) {
+        PyErr_SetString(Py_ExceptionXml, err.message().c_str());
+    }
+}
+
+#pragma mark -
+#pragma mark Argument unpacking
+
+#if XML_WRITE_FASTCALL
+/* Unpack METH_FASTCALL | METH_KEYWORDS or vectorcall arguments into values
+ * in the order of kwlist, by position then by keyword, the first required
+ * of them must be given. values are borrowed references and are left
+ * unchanged if not given.
+ * On failure this sets an error in the style of PyArg_ParseTupleAndKeywords
+ * and returns false.
+ */
+static bool
+unpack_fastcall_args(const char *fname, const char *const *kwlist,
+                     Py_ssize_t required, PyObject *const *args,
+                     Py_ssize_t nargs, PyObject *kwnames, PyObject **values) {
+    Py_ssize_t count = 0;
+    while (kwlist[count]) {
+        ++count;
+    }
+    if (nargs > count) {
+        PyErr_Format(PyExc_TypeError,
+                     "%s() takes at most %zd arguments (%zd given)",
+                     fname, count, nargs);
+        return false;
+    }
+    for (Py_ssize_t i = 0; i < nargs; ++i) {
+        values[i] = args[i];
+    }
+    Py_ssize_t nkw = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+    for (Py_ssize_t k = 0; k < nkw; ++k) {
+        PyObject *key = PyTuple_GET_ITEM(kwnames, k);
+        Py_ssize_t i = 0;
+        while (i < count && PyUnicode_CompareWithASCIIString(key, kwlist[i]) != 0) {
+            ++i;
+        }
+        if (i == count) {
+            PyErr_Format(PyExc_TypeError,
+                         "'%U' is an invalid keyword argument for %s()",
+                         key, fname);
+            return false;
+        }
+        if (i < nargs) {
+            PyErr_Format(PyExc_TypeError,
+                         "argument for %s() given by name ('%s') and position (%zd)",
+                         fname, kwlist[i], i + 1);
+            return false;
+        }
+        values[i] = args[nargs + k];
+    }
+    for (Py_ssize_t i = 0; i < required; ++i) {
+        if (! values[i]) {
+            PyErr_Format(PyExc_TypeError,
+                         "%s() missing required argument '%s' (pos %zd)",
+                         fname, kwlist[i], i + 1);
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+#pragma mark -
+#pragma mark String conversion
+
+/* A str as an XmlStringView of its UTF-8 without a copy. This is the UTF-8
+ * cached by the str so it is valid while py_str is alive. Any str is
+ * accepted, not only Latin-1.
+ * On failure this sets PyErr_Occurred() and returns false.
+ */
+static bool
+py_str_to_view(PyObject *py_str, XmlStringView &view) {
+    if (! PyUnicode_Check(py_str)) {
+        PyErr_Format(PyExc_TypeError,
+                     "Argument must be str not \"%s\"",
+                     Py_TYPE(py_str)->tp_name);
+        return false;
+    }
+    Py_ssize_t size;
+    const char *data = CPythonCpp::py_unicode_as_utf8(py_str, &size);
+    if (! data) {
+        return false;
+    }
+    view = XmlStringView(data, static_cast<size_t>(size));
+    return true;
+}
+
+#pragma mark -
+#pragma mark Attribute conversion
+
+/* Convert a dict[str, str] to XmlAttrs, the attributes are added in dict
+ * order.
+ * On failure this sets PyErr_Occurred() and attrs will be empty.
+ */
+static void
+py_dict_to_xml_attrs(PyObject *dict, XmlAttrs &attrs) {
+    Py_ssize_t pos = 0;
+    PyObject *key = NULL;
+    PyObject *val = NULL;
+
+    attrs.clear();
+    if (! PyDict_Check(dict)) {
+        PyErr_Format(PyExc_TypeError,
+                     "Argument \"attrs\" to %s must be dict not \"%s\"",
+                     __FUNCTION__, Py_TYPE(dict)->tp_name);
+        return;
+    }
+    while (PyDict_Next(dict, &pos, &key, &val)) {
+        XmlStringView cpp_key;
+        XmlStringView cpp_val;
+        if (! py_str_to_view(key, cpp_key) || ! py_str_to_view(val, cpp_val)) {
+            attrs.clear();
+            return;
+        }
+        // Dict keys are unique. This copies the bytes once, into attrs.
+        attrs.add(cpp_key, cpp_val);
+    }
+}
+
+#pragma mark -
+#pragma mark Blocking sections
+
+/* Hooks for XmlBlockingSection so that the GIL is released while a sink
+ * blocks, for example on write(2) to a pipe that is read by another Python
+ * thread. Background threads, such as that of a background=True stream, do
+ * not hold the GIL so nothing is done for them.
+ */
+static void *
+blocking_section_begin() {
+    if (! PyGILState_Check()) {
+        return NULL;
+    }
+    return PyEval_SaveThread();
+}
+
+static void
+blocking_section_end(void *state) {
+    if (state) {
+        PyEval_RestoreThread(static_cast<PyThreadState *>(state));
+    }
+}
+
 #pragma mark -
 #pragma mark Generic init for XmlStream and XhtmlStream
 
+/* A sink that calls the write() method of a Python file like object.
+ * The XmlBuffer batches the output so write() is called once per flushSize
+ * bytes rather than once per element.
+ * If the object is a binary file, that is not an io.TextIOBase, then write()
+ * is given bytes otherwise str.
+ * If write() fails then the Python exception is left set and an ExceptionXml
+ * is thrown.
+ */
+class XmlSinkPyFile : public XmlSinkUtf8 {
+public:
+    XmlSinkPyFile(PyObject *write_method, bool is_text) : _write(write_method),
+                                                         _is_text(is_text) {
+        Py_INCREF(_write);
+    }
+    virtual ~XmlSinkPyFile() {
+        Py_DECREF(_write);
+    }
+protected:
+    virtual void writeUtf8(const char *data, size_t len) {
+        PyObject *chunk = NULL;
+        if (_is_text) {
+            chunk = PyUnicode_DecodeUTF8(data, len, NULL);
+        } else {
+            chunk = PyBytes_FromStringAndSize(data, len);
+        }
+        if (! chunk) {
+            throw ExceptionXml("Can not create chunk for write()");
+        }
+        PyObject *result = PyObject_CallFunctionObjArgs(_write, chunk, NULL);
+        Py_DECREF(chunk);
+        if (! result) {
+            throw ExceptionXml("write() failed");
+        }
+        Py_DECREF(result);
+    }
+    PyObject *_write;
+    bool _is_text;
+};
+
+/* Returns 1 if the object is an io.TextIOBase, 0 if not, -1 on error. */
+static int
+is_text_file(PyObject *theFile) {
+    static PyObject *text_io_base = NULL;
+    if (! text_io_base) {
+        PyObject *io = PyImport_ImportModule("io");
+        if (! io) {
+            return -1;
+        }
+        text_io_base = PyObject_GetAttrString(io, "TextIOBase");
+        Py_DECREF(io);
+        if (! text_io_base) {
+            return -1;
+        }
+    }
+    return PyObject_IsInstance(theFile, text_io_base);
+}
+
+/* Create a sink from the "theFile" argument. This can be:
+ * - An int that is an open file descriptor.
+ * - An object with a write() method, io.TextIOBase objects are given str,
+ *   others are given bytes.
+ * - A str or os.PathLike that is the path of a file to create.
+ * On failure this returns nullptr and sets a Python exception.
+ */
+static std::unique_ptr<XmlSink>
+py_file_to_sink(PyObject *theFile) {
+    std::unique_ptr<XmlSink> sink;
+    PyObject *write_method = NULL;
+    PyObject *path = NULL;
+    try {
+        if (PyBool_Check(theFile)) {
+            PyErr_SetString(PyExc_TypeError,
+                            "Argument \"theFile\" must not be a bool");
+        } else if (PyLong_Check(theFile)) {
+            // This raises for a negative value or one that overflows an int.
+            int fd = PyObject_AsFileDescriptor(theFile);
+            if (fd >= 0) {
+                sink.reset(new XmlSinkFd(fd));
+            }
+        } else if (! PyUnicode_Check(theFile)
+                   && PyObject_HasAttrString(theFile, "write")) {
+            write_method = PyObject_GetAttrString(theFile, "write");
+            int is_text = is_text_file(theFile);
+            if (write_method && is_text >= 0) {
+                sink.reset(new XmlSinkPyFile(write_method, is_text == 1));
+            }
+        } else {
+            // str or os.PathLike, this raises a TypeError for anything else.
+            path = PyOS_FSPath(theFile);
+            if (path && PyUnicode_Check(path)) {
+                std::string path_str = CPythonCpp::py_utf8_to_std_string(path);
+                if (! PyErr_Occurred()) {
+                    sink.reset(new XmlSinkFd(path_str));
+                }
+            } else if (path && PyBytes_Check(path)) {
+                sink.reset(new XmlSinkFd(std::string(PyBytes_AS_STRING(path),
+                                                     PyBytes_GET_SIZE(path))));
+            }
+        }
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        sink.reset();
+    }
+    Py_XDECREF(write_method);
+    Py_XDECREF(path);
+    if (PyErr_Occurred()) {
+        sink.reset();
+    }
+    return sink;
+}
+
+#pragma mark -
+#pragma mark Stream pool
+
+/* The C++ stream of a deallocated XmlStream or XhtmlStream is kept for the
+ * next one of that type which resets it rather than constructing a new one.
+ * The reused stream keeps the memory of its buffer, element stack and
+ * element names. Only in memory streams with a buffer no larger than
+ * STREAM_POOL_MAX_CAPACITY and no more than MAX_NAMES_KEPT element names are
+ * kept. Access is protected by the GIL.
+ */
+static const size_t STREAM_POOL_SIZE = 8;
+static const size_t STREAM_POOL_MAX_CAPACITY = 1024 * 1024;
+
+template <typename CppType>
+struct StreamPool {
+    static CppType *streams[STREAM_POOL_SIZE];
+    static size_t count;
+};
+
+template <typename CppType>
+CppType *StreamPool<CppType>::streams[STREAM_POOL_SIZE];
+
+template <typename CppType>
+size_t StreamPool<CppType>::count = 0;
+
+/* Returns a stream from the pool or nullptr if the pool is empty. */
+template <typename CppType>
+static CppType *
+stream_pool_acquire() {
+    if (StreamPool<CppType>::count) {
+        return StreamPool<CppType>::streams[--StreamPool<CppType>::count];
+    }
+    return nullptr;
+}
+
+/* Return a stream to the pool or delete it. */
+template <typename Stream, typename CppType>
+static void
+stream_pool_release(Stream *p_stream) {
+    CppType *stream = static_cast<CppType *>(p_stream);
+    if (StreamPool<CppType>::count < STREAM_POOL_SIZE
+        && ! stream->output().hasSink()
+        && stream->output().capacity() <= STREAM_POOL_MAX_CAPACITY
+        && stream->nameCount() <= CppType::MAX_NAMES_KEPT) {
+        StreamPool<CppType>::streams[StreamPool<CppType>::count++] = stream;
+    } else {
+        delete stream;
+    }
+}
+
+/* Delete the streams in the pool. */
+template <typename CppType>
+static void
+stream_pool_clear() {
+    while (StreamPool<CppType>::count) {
+        delete StreamPool<CppType>::streams[--StreamPool<CppType>::count];
+    }
+}
+
 // Some template magic to create a constructor used by both
 // XmlStream and XhtmlStream
 template <typename PyType, typename CppType>
@@ -147,28 +484,167 @@ Generic_Stream_init(PyType *self, PyObject *args, PyObject *kwds) {
     int ret = 0;
     static CPythonCpp::DefaultArg theEnc { PyUnicode_FromString("utf-8") };
     static CPythonCpp::DefaultArg theDtdLocal { PyUnicode_FromString("") };
-    static CPythonCpp::DefaultArg theId { PyLong_FromLong(0L) };
-    static CPythonCpp::DefaultArg mustIndent { PyBool_FromLong(1L) };
-
-    if (!theEnc || !theDtdLocal || !theId || !mustIndent) {
+    int theId = 0;
+    int mustIndent = 1;
+    PyObject *theFile = NULL;
+    Py_ssize_t flushSize = XmlBuffer::DEFAULT_FLUSH_SIZE;
+    Py_ssize_t sizeHint = 0;
+    const char *profile = NULL;
+    int background = 0;
+    const char *compression = NULL;
+    int compressionLevel = Z_DEFAULT_COMPRESSION;
+    Py_ssize_t compressionSyncSize = 0;
+    Py_ssize_t compressionThreads = 1;
+    Py_ssize_t compressionBlockSize = 0;
+    std::unique_ptr<XmlSink> sink;
+    bool is_fd = false;
+
+    if (!theEnc || !theDtdLocal) {
         return -1;
     }
     static const char *kwlist[] = {
-        "theEnc", "theDtdLocal", "theId", "mustIndent", NULL
+        "theEnc", "theDtdLocal", "theId", "mustIndent", "theFile", "flushSize",
+        "sizeHint", "profile", "background",
+        "compression", "compressionLevel", "compressionSyncSize",
+        "compressionThreads", "compressionBlockSize", NULL
     };
 
-    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|OOip",
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|OOipOnnzpzinnn",
                                       const_cast<char**>(kwlist),
                                       &theEnc, &theDtdLocal,
-                                      &theId, &mustIndent)) {
+                                      &theId, &mustIndent,
+                                      &theFile, &flushSize,
+                                      &sizeHint, &profile, &background,
+                                      &compression, &compressionLevel,
+                                      &compressionSyncSize, &compressionThreads,
+                                      &compressionBlockSize)) {
+        return -1;
+    }
+    if (flushSize <= 0) {
+        PyErr_Format(PyExc_ValueError,
+                     "Argument \"flushSize\" must be > 0 not %zd", flushSize);
+        return -1;
+    }
+    if (sizeHint < 0) {
+        PyErr_Format(PyExc_ValueError,
+                     "Argument \"sizeHint\" must be >= 0 not %zd", sizeHint);
+        return -1;
+    }
+    if (compressionSyncSize < 0) {
+        PyErr_Format(PyExc_ValueError,
+                     "Argument \"compressionSyncSize\" must be >= 0 not %zd",
+                     compressionSyncSize);
         return -1;
     }
-    self->p_stream = new CppType(
-        CPythonCpp::py_utf8_to_std_string((PyObject*)theEnc),
-        CPythonCpp::py_utf8_to_std_string((PyObject*)theDtdLocal),
-        static_cast<int>(PyLong_AsLong(theId)),
-        mustIndent == Py_True ? true : false
-    );
+    if (compressionThreads < 0) {
+        PyErr_Format(PyExc_ValueError,
+                     "Argument \"compressionThreads\" must be >= 0 not %zd",
+                     compressionThreads);
+        return -1;
+    }
+    if (compressionBlockSize < 0) {
+        PyErr_Format(PyExc_ValueError,
+                     "Argument \"compressionBlockSize\" must be >= 0 not %zd",
+                     compressionBlockSize);
+        return -1;
+    }
+    // Each block of the threads ends with a sync flush so a sync size only
+    // applies to one thread and a block size only to several.
+    if (compressionThreads == 1 && compressionBlockSize) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Argument \"compressionBlockSize\" needs \"compressionThreads\" other than 1");
+        return -1;
+    }
+    if (compressionThreads != 1 && compressionSyncSize) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Argument \"compressionSyncSize\" needs \"compressionThreads\" of 1");
+        return -1;
+    }
+    if (theFile && theFile != Py_None) {
+        sink = py_file_to_sink(theFile);
+        if (! sink) {
+            return -1;
+        }
+        is_fd = dynamic_cast<XmlSinkFd *>(sink.get()) != nullptr;
+    }
+    if (compression) {
+        XmlSinkZlib::Format format;
+        if (strcmp(compression, "gzip") == 0) {
+            format = XmlSinkZlib::FORMAT_GZIP;
+        } else if (strcmp(compression, "zlib") == 0) {
+            format = XmlSinkZlib::FORMAT_ZLIB;
+        } else {
+            PyErr_Format(PyExc_ValueError,
+                         "Argument \"compression\" must be \"gzip\", \"zlib\" or None not \"%s\"",
+                         compression);
+            return -1;
+        }
+        if (! sink) {
+            PyErr_SetString(PyExc_ValueError,
+                            "Argument \"compression\" needs \"theFile\"");
+            return -1;
+        }
+        try {
+            if (compressionThreads == 1) {
+                sink.reset(new XmlSinkZlib(std::move(sink), compressionLevel, format,
+                                           static_cast<size_t>(compressionSyncSize)));
+            } else {
+                sink.reset(new XmlSinkZlibParallel(std::move(sink), compressionLevel, format,
+                                                   static_cast<size_t>(compressionThreads),
+                                                   static_cast<size_t>(compressionBlockSize)));
+            }
+        } catch (ExceptionXml &err) {
+            set_py_exception_from(err);
+            return -1;
+        }
+    }
+    if (background) {
+        // The writer thread runs without the GIL so can not call Python.
+        // Any compression is also done by the thread.
+        if (! is_fd) {
+            PyErr_SetString(PyExc_ValueError,
+                            "Argument \"background\" needs \"theFile\" to be a file descriptor or path");
+            return -1;
+        }
+        sink.reset(new XmlSinkThread(std::move(sink)));
+    }
+    std::string enc = CPythonCpp::py_utf8_to_std_string((PyObject*)theEnc);
+    std::string dtd_local = CPythonCpp::py_utf8_to_std_string((PyObject*)theDtdLocal);
+    if (PyErr_Occurred()) {
+        return -1;
+    }
+    CppType *stream = nullptr;
+    if (self->p_stream && self->p_release == &stream_pool_release<typename PyType::tStream, CppType>) {
+        // __init__ called again, reset in place as an Element may refer to
+        // the stream.
+        stream = static_cast<CppType *>(self->p_stream);
+    } else {
+        if (self->p_stream) {
+            self->p_release(self->p_stream);
+            self->p_stream = nullptr;
+        }
+        stream = stream_pool_acquire<CppType>();
+    }
+    if (stream) {
+        try {
+            stream->reset(enc, dtd_local, theId, mustIndent ? true : false,
+                          std::move(sink), static_cast<size_t>(flushSize),
+                          static_cast<size_t>(sizeHint), profile ? profile : "");
+        } catch (ExceptionXml &err) {
+            set_py_exception_from(err);
+            if (! self->p_stream) {
+                // From the pool.
+                delete stream;
+            }
+            return -1;
+        }
+    } else {
+        stream = new CppType(enc, dtd_local, theId, mustIndent ? true : false,
+                             std::move(sink), static_cast<size_t>(flushSize),
+                             static_cast<size_t>(sizeHint), profile ? profile : "");
+    }
+    self->p_stream = stream;
+    self->p_release = &stream_pool_release<typename PyType::tStream, CppType>;
 #if XML_WRITE_DEBUG_TRACE
     std::cout << "Generic_Stream_init() self: " << self;
     std::cout << " p_stream: " << self->p_stream << std::endl;
@@ -179,30 +655,271 @@ Generic_Stream_init(PyType *self, PyObject *args, PyObject *kwds) {
     return ret;
 }
 
+#pragma mark -
+#pragma mark CommandBuffer
+/******************* CommandBuffer ********************/
+/* Records start(), text() and end() to be replayed by XmlStream.execute().
+ * The strings are copied into the XmlCommandBuffer so later changes to the
+ * Python objects do not affect it.
+ */
+typedef struct {
+    PyObject_HEAD
+    XmlCommandBuffer *p_commands;
+} cCommandBuffer;
+
+static void
+cCommandBuffer_dealloc(cCommandBuffer* self) {
+    delete self->p_commands;
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject *
+cCommandBuffer_new(PyTypeObject *type, PyObject */* args */, PyObject */* kwds */) {
+    cCommandBuffer *self = (cCommandBuffer *)type->tp_alloc(type, 0);
+    if (self != NULL) {
+        try {
+            self->p_commands = new XmlCommandBuffer();
+        } catch (std::bad_alloc &) {
+            Py_DECREF(self);
+            return PyErr_NoMemory();
+        }
+    }
+    return (PyObject *)self;
+}
+
+/* attrs may be NULL or None. Nothing is recorded if this fails. */
+static PyObject *
+cCommandBuffer_start_impl(cCommandBuffer *self, PyObject *name, PyObject *attrs) {
+    XmlStringView cpp_name;
+    XmlStringView cpp_key;
+    XmlStringView cpp_val;
+    Py_ssize_t pos = 0;
+    PyObject *key = NULL;
+    PyObject *val = NULL;
+
+    if (attrs == Py_None) {
+        attrs = NULL;
+    }
+    if (attrs && ! PyDict_Check(attrs)) {
+        PyErr_Format(PyExc_TypeError,
+                     "Argument \"attrs\" to start() must be dict or None not \"%s\"",
+                     Py_TYPE(attrs)->tp_name);
+        return NULL;
+    }
+    if (! py_str_to_view(name, cpp_name)) {
+        return NULL;
+    }
+    // Check all the attributes before recording any of them, the UTF-8 is
+    // cached by each str so the second pass does not convert again.
+    if (attrs) {
+        while (PyDict_Next(attrs, &pos, &key, &val)) {
+            if (! py_str_to_view(key, cpp_key) || ! py_str_to_view(val, cpp_val)) {
+                return NULL;
+            }
+        }
+    }
+    try {
+        self->p_commands->start(cpp_name);
+        if (attrs) {
+            pos = 0;
+            while (PyDict_Next(attrs, &pos, &key, &val)) {
+                py_str_to_view(key, cpp_key);
+                py_str_to_view(val, cpp_val);
+                // Dict keys are unique.
+                self->p_commands->attribute(cpp_key, cpp_val);
+            }
+        }
+    } catch (ExceptionXml &err) {
+        // Being executed, nothing has been recorded.
+        set_py_exception_from(err);
+        return NULL;
+    } catch (std::bad_alloc &) {
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+#if XML_WRITE_FASTCALL
+static PyObject *
+cCommandBuffer_start(cCommandBuffer *self, PyObject *const *args,
+                     Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *kwlist[] = { "name", "attrs", NULL };
+    PyObject *values[2] = { NULL, NULL };
+
+    if (! unpack_fastcall_args("start", kwlist, 1, args, nargs, kwnames, values)) {
+        return NULL;
+    }
+    return cCommandBuffer_start_impl(self, values[0], values[1]);
+}
+#else
+static PyObject *
+cCommandBuffer_start(cCommandBuffer *self, PyObject *args, PyObject *kwds) {
+    PyObject *name = NULL;
+    PyObject *attrs = NULL;
+
+    static const char *kwlist[] = { "name", "attrs", NULL };
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|O",
+                                      const_cast<char**>(kwlist),
+                                      &name, &attrs)) {
+        return NULL;
+    }
+    return cCommandBuffer_start_impl(self, name, attrs);
+}
+#endif
+
+static PyObject *
+cCommandBuffer_text(cCommandBuffer *self, PyObject *arg) {
+    XmlStringView cpp_text;
+
+    if (! py_str_to_view(arg, cpp_text)) {
+        return NULL;
+    }
+    try {
+        self->p_commands->text(cpp_text);
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    } catch (std::bad_alloc &) {
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+cCommandBuffer_end(cCommandBuffer *self) {
+    try {
+        self->p_commands->end();
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    } catch (std::bad_alloc &) {
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+cCommandBuffer_clear(cCommandBuffer *self) {
+    try {
+        self->p_commands->clear();
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static Py_ssize_t
+cCommandBuffer_len(cCommandBuffer *self) {
+    return static_cast<Py_ssize_t>(self->p_commands->size());
+}
+
+static PyMethodDef cCommandBuffer_methods[] = {
+    {"start", (PyCFunction)cCommandBuffer_start, XML_WRITE_METH_KEYWORDS,
+        "Record a startElement(name, attrs), attrs is a dict or None."
+    },
+    {"text", (PyCFunction)cCommandBuffer_text, METH_O,
+        "Record a characters(text), consecutive text is joined."
+    },
+    {"end", (PyCFunction)cCommandBuffer_end, METH_NOARGS,
+        "Record the end of the innermost open element."
+    },
+    {"clear", (PyCFunction)cCommandBuffer_clear, METH_NOARGS,
+        "Discard the recorded operations so that the buffer can be reused."
+    },
+    { NULL, NULL, 0, NULL }  /* Sentinel */
+};
+
+static PySequenceMethods cCommandBuffer_as_sequence = {
+    (lenfunc)cCommandBuffer_len, /* sq_length */
+};
+
+static PyTypeObject cCommandBufferType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cXmlWrite.CommandBuffer", /* tp_name */
+    sizeof(cCommandBuffer),    /* tp_basicsize */
+    0,                         /* tp_itemsize */
+    (destructor)cCommandBuffer_dealloc, /* tp_dealloc */
+    0,                         /* tp_print */
+    0,                         /* tp_getattr */
+    0,                         /* tp_setattr */
+    0,                         /* tp_reserved */
+    0,                         /* tp_repr */
+    0,                         /* tp_as_number */
+    &cCommandBuffer_as_sequence, /* tp_as_sequence */
+    0,                         /* tp_as_mapping */
+    0,                         /* tp_hash  */
+    0,                         /* tp_call */
+    0,                         /* tp_str */
+    0,                         /* tp_getattro */
+    0,                         /* tp_setattro */
+    0,                         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,        /* tp_flags */
+    "A batch of start(), text() and end() operations for XmlStream.execute().", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    cCommandBuffer_methods,    /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                         /* tp_init */
+    0,                         /* tp_alloc */
+    cCommandBuffer_new,        /* tp_new */
+};
+/**************** END: CommandBuffer ******************/
+
 #pragma mark -
 #pragma mark XmlStream
 /******************* XmlStream ********************/
-typedef struct {
+/* An XmlStream in Python, Stream is XmlStream or XmlStreamFast. */
+template <typename Stream>
+struct cBasicXmlStream {
+    typedef Stream tStream;
     PyObject_HEAD
-    XmlStream *p_stream;
-} cXmlStream;
+    Stream *p_stream;
+    // Returns p_stream to the pool of its type.
+    void (*p_release)(Stream *);
+    // Reused for the attributes of each startElement() and Element so that
+    // they do not allocate once the capacity is reached.
+    tAttrs *p_attrs;
+};
 
+template <typename Stream>
 static void
-cXmlStream_dealloc(cXmlStream* self) {
+cXmlStream_dealloc(cBasicXmlStream<Stream> *self) {
 #if XML_WRITE_DEBUG_TRACE
     std::cout << "cXmlStream_dealloc() self: " << self;
     std::cout << " p_stream: " << self->p_stream << std::endl;
 #endif
-    delete self->p_stream;
+    if (self->p_stream) {
+        self->p_release(self->p_stream);
+    }
+    delete self->p_attrs;
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
+template <typename Stream>
 static PyObject *
 cXmlStream_new(PyTypeObject *type, PyObject */* args */, PyObject */* kwds */)
 {
-    cXmlStream *self = (cXmlStream *)type->tp_alloc(type, 0);
+    cBasicXmlStream<Stream> *self = (cBasicXmlStream<Stream> *)type->tp_alloc(type, 0);
     if (self != NULL) {
         self->p_stream = nullptr;
+        self->p_release = nullptr;
+        try {
+            self->p_attrs = new tAttrs();
+        } catch (std::bad_alloc &) {
+            Py_DECREF(self);
+            return PyErr_NoMemory();
+        }
     }
 #if XML_WRITE_DEBUG_TRACE
     std::cout << "cXmlStream_new() type: " << type;
@@ -211,18 +928,75 @@ cXmlStream_new(PyTypeObject *type, PyObject */* args */, PyObject */* kwds */)
     return (PyObject *)self;
 }
 
+template <typename Stream>
 static PyObject *
-cXmlStream_getvalue(cXmlStream* self) {
+cXmlStream_getvalue(cBasicXmlStream<Stream> *self) {
 #if XML_WRITE_DEBUG_TRACE
     std::cout << "cXmlStream_getvalue() self: " << self;
     std::cout << " p_stream: " << self->p_stream << std::endl;
 #endif
-    std::string value = self->p_stream->getvalue();
-    return CPythonCpp::std_string_to_py_utf8(value);
+    try {
+        return CPythonCpp::std_string_to_py_utf8(self->p_stream->getbuffer());
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+    }
+    return NULL;
+}
+
+/* Returns the document as bytes with a single copy. */
+template <typename Stream>
+static PyObject *
+cXmlStream_getvalue_bytes(cBasicXmlStream<Stream> *self) {
+    try {
+        const std::string &value = self->p_stream->getbuffer();
+        return PyBytes_FromStringAndSize(value.data(), value.size());
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+    }
+    return NULL;
+}
+
+/* Returns the bytes written since the last drain() and releases them. */
+template <typename Stream>
+static PyObject *
+cXmlStream_drain(cBasicXmlStream<Stream> *self) {
+    try {
+        std::string value = self->p_stream->drain();
+        return PyBytes_FromStringAndSize(value.data(), value.size());
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+    }
+    return NULL;
+}
+
+/* Writes the document to a file descriptor, or an object with a fileno()
+ * method, without joining the output into one string. */
+template <typename Stream>
+static PyObject *
+cXmlStream_writeTo(cBasicXmlStream<Stream> *self, PyObject *arg) {
+    int fd = PyObject_AsFileDescriptor(arg);
+    if (fd < 0) {
+        return NULL;
+    }
+    try {
+        self->p_stream->writeTo(fd);
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/* Returns a read only memoryview of the document without copying it. */
+template <typename Stream>
+static PyObject *
+cXmlStream_getbuffer(cBasicXmlStream<Stream> *self) {
+    return PyMemoryView_FromObject((PyObject *)self);
 }
 
+template <typename Stream>
 static PyObject *
-cXmlStream__flipIndent(cXmlStream *self, PyObject *arg) {
+cXmlStream__flipIndent(cBasicXmlStream<Stream> *self, PyObject *arg) {
     Py_INCREF(arg);
     PyObject *ret = NULL;
     if (! PyBool_Check(arg)) {
@@ -246,40 +1020,59 @@ finally:
     return ret;
 }
 
+template <typename Stream>
 static PyObject *
-cXmlStream_xmlSpacePreserve(cXmlStream *self) {
+cXmlStream_xmlSpacePreserve(cBasicXmlStream<Stream> *self) {
     self->p_stream->xmlSpacePreserve();
     Py_INCREF(Py_None);
     return Py_None;
 }
 
+/* Returns the stream's p_attrs cleared for the attributes of a start tag or
+ * NULL with an ExceptionXml set if the stream is busy. A flush part way
+ * through a startElement() may release the GIL or call a Python write()
+ * and that startElement() still holds views of p_attrs, so another
+ * startElement() must not refill it.
+ */
+template <typename Stream>
+static tAttrs *
+cXmlStream_scratch_attrs(cBasicXmlStream<Stream> *self) {
+    try {
+        self->p_stream->output().checkNotBusy();
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    }
+    self->p_attrs->clear();
+    return self->p_attrs;
+}
+
+/* attrs may be NULL. */
+template <typename Stream>
 static PyObject *
-cXmlStream_startElement(cXmlStream *self, PyObject *args, PyObject *kwds) {
-    PyObject *name = NULL;
-    PyObject *attrs = NULL;
+cXmlStream_startElement_impl(cBasicXmlStream<Stream> *self, PyObject *name, PyObject *attrs) {
     PyObject *ret = NULL;
-    std::string cpp_name;
-    tAttrs cpp_attrs;
+    XmlStringView cpp_name;
+    tAttrs *cpp_attrs = cXmlStream_scratch_attrs(self);
 
-    static const char *kwlist[] = { "name", "attrs", NULL };
-    if (! PyArg_ParseTupleAndKeywords(args, kwds, "s|O",
-                                      const_cast<char**>(kwlist),
-                                      &name, &attrs)) {
+    if (! cpp_attrs) {
         goto except;
     }
     if (attrs) {
-        cpp_attrs = CPythonCpp::py_dict_to_std_map(attrs,
-                                                   &CPythonCpp::py_utf8_to_std_string,
-                                                   &CPythonCpp::py_utf8_to_std_string);
+        py_dict_to_xml_attrs(attrs, *cpp_attrs);
         if (PyErr_Occurred()) {
             goto except;
         }
     }
-    cpp_name = CPythonCpp::py_utf8_to_std_string(name);
-    if (PyErr_Occurred()) {
+    if (! py_str_to_view(name, cpp_name)) {
+        goto except;
+    }
+    try {
+        self->p_stream->startElement(cpp_name, *cpp_attrs);
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
         goto except;
     }
-    self->p_stream->startElement(cpp_name, cpp_attrs);
     assert(! PyErr_Occurred());
     Py_INCREF(Py_None);
     ret = Py_None;
@@ -292,20 +1085,59 @@ finally:
     return ret;
 }
 
-typedef void (XmlStream::*type_str_fn)(const std::string &);
+#if XML_WRITE_FASTCALL
+template <typename Stream>
+static PyObject *
+cXmlStream_startElement(cBasicXmlStream<Stream> *self, PyObject *const *args,
+                        Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *kwlist[] = { "name", "attrs", NULL };
+    PyObject *values[2] = { NULL, NULL };
+
+    if (! unpack_fastcall_args("startElement", kwlist, 1, args, nargs, kwnames, values)) {
+        return NULL;
+    }
+    return cXmlStream_startElement_impl(self, values[0], values[1]);
+}
+#else
+template <typename Stream>
+static PyObject *
+cXmlStream_startElement(cBasicXmlStream<Stream> *self, PyObject *args, PyObject *kwds) {
+    PyObject *name = NULL;
+    PyObject *attrs = NULL;
+
+    static const char *kwlist[] = { "name", "attrs", NULL };
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|O",
+                                      const_cast<char**>(kwlist),
+                                      &name, &attrs)) {
+        return NULL;
+    }
+    return cXmlStream_startElement_impl(self, name, attrs);
+}
+#endif
+
 #define CALL_MEMBER_FN(object, ptrToMember) ((object).*(ptrToMember))
 
-/* Call a function on XmlStream with a function pointer in XmlStream:: and
- * a single Python argument that is expected to be convertible to a std::string.
+/* Call a function on XmlStream with a function pointer in Stream:: and
+ * a single Python argument that is expected to be a str. The function is
+ * given a view of the UTF-8 of the str, there is no copy.
  */
+template <typename Stream>
 static PyObject *
-cXmlStream_generic_string(XmlStream &stream, type_str_fn fn, PyObject *arg) {
+cXmlStream_generic_string(Stream &stream, void (Stream::*fn)(XmlStringView), PyObject *arg) {
     PyObject *ret = NULL;
-    std::string chars { CPythonCpp::py_utf8_to_std_string(arg) };
-    if (PyErr_Occurred()) {
+    XmlStringView chars;
+    if (! py_str_to_view(arg, chars)) {
+        goto except;
+    }
+    try {
+        CALL_MEMBER_FN(stream, fn)(chars);
+    } catch (ExceptionXmlEndElement &) {
+        // Let the caller decide how to handle this.
+        throw;
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
         goto except;
     }
-    CALL_MEMBER_FN(stream, fn)(chars);
     assert(! PyErr_Occurred());
     Py_INCREF(Py_None);
     ret = Py_None;
@@ -318,29 +1150,33 @@ finally:
     return ret;
 }
 
+template <typename Stream>
 static PyObject *
-cXmlStream_characters(cXmlStream *self, PyObject *arg) {
-    return cXmlStream_generic_string(*self->p_stream, &XmlStream::characters, arg);
+cXmlStream_characters(cBasicXmlStream<Stream> *self, PyObject *arg) {
+    return cXmlStream_generic_string(*self->p_stream, &Stream::characters, arg);
 }
 
+template <typename Stream>
 static PyObject *
-cXmlStream_literal(cXmlStream *self, PyObject *arg) {
-    return cXmlStream_generic_string(*self->p_stream, &XmlStream::literal, arg);
+cXmlStream_literal(cBasicXmlStream<Stream> *self, PyObject *arg) {
+    return cXmlStream_generic_string(*self->p_stream, &Stream::literal, arg);
 }
 
+template <typename Stream>
 static PyObject *
-cXmlStream_comment(cXmlStream *self, PyObject *args, PyObject *kwds) {
+cXmlStream_comment_impl(cBasicXmlStream<Stream> *self, PyObject *py_comment, int new_line) {
     PyObject *ret = NULL;
-    int new_line = 0;
-    const char *comment = NULL;
+    XmlStringView comment;
 
-    static const char *kwlist[] = { "theS", "newLine", NULL };
-    if (! PyArg_ParseTupleAndKeywords(args, kwds, "s|p",
-                                      const_cast<char**>(kwlist),
-                                      &comment, &new_line)) {
+    if (! py_str_to_view(py_comment, comment)) {
+        goto except;
+    }
+    try {
+        self->p_stream->comment(comment, new_line ? true : false);
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
         goto except;
     }
-    self->p_stream->comment(comment, new_line ? true : false);
     assert(! PyErr_Occurred());
     Py_INCREF(Py_None);
     ret = Py_None;
@@ -353,16 +1189,55 @@ finally:
     return ret;
 }
 
+#if XML_WRITE_FASTCALL
+template <typename Stream>
+static PyObject *
+cXmlStream_comment(cBasicXmlStream<Stream> *self, PyObject *const *args,
+                   Py_ssize_t nargs, PyObject *kwnames) {
+    static const char *kwlist[] = { "theS", "newLine", NULL };
+    PyObject *values[2] = { NULL, NULL };
+    int new_line = 0;
+
+    if (! unpack_fastcall_args("comment", kwlist, 1, args, nargs, kwnames, values)) {
+        return NULL;
+    }
+    if (values[1]) {
+        new_line = PyObject_IsTrue(values[1]);
+        if (new_line < 0) {
+            return NULL;
+        }
+    }
+    return cXmlStream_comment_impl(self, values[0], new_line);
+}
+#else
+template <typename Stream>
+static PyObject *
+cXmlStream_comment(cBasicXmlStream<Stream> *self, PyObject *args, PyObject *kwds) {
+    int new_line = 0;
+    PyObject *py_comment = NULL;
+
+    static const char *kwlist[] = { "theS", "newLine", NULL };
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|p",
+                                      const_cast<char**>(kwlist),
+                                      &py_comment, &new_line)) {
+        return NULL;
+    }
+    return cXmlStream_comment_impl(self, py_comment, new_line);
+}
+#endif
+
+template <typename Stream>
 static PyObject *
-cXmlStream_pI(cXmlStream *self, PyObject *arg) {
-    return cXmlStream_generic_string(*self->p_stream, &XmlStream::pI, arg);
+cXmlStream_pI(cBasicXmlStream<Stream> *self, PyObject *arg) {
+    return cXmlStream_generic_string(*self->p_stream, &Stream::pI, arg);
 }
 
+template <typename Stream>
 static PyObject *
-cXmlStream_endElement(cXmlStream *self, PyObject *arg) {
+cXmlStream_endElement(cBasicXmlStream<Stream> *self, PyObject *arg) {
     try {
         return cXmlStream_generic_string(*self->p_stream,
-                                         &XmlStream::endElement,
+                                         &Stream::endElement,
                                          arg);
     } catch(ExceptionXmlEndElement &err) {
         PyErr_Format(Py_ExceptionXmlEndElement,
@@ -372,23 +1247,26 @@ cXmlStream_endElement(cXmlStream *self, PyObject *arg) {
     return NULL;
 }
 
+template <typename Stream>
 static PyObject *
-cXmlStream_writeECMAScript(cXmlStream *self, PyObject *arg) {
+cXmlStream_writeECMAScript(cBasicXmlStream<Stream> *self, PyObject *arg) {
     return cXmlStream_generic_string(*self->p_stream,
-                                     &XmlStream::writeECMAScript,
+                                     &Stream::writeECMAScript,
                                      arg);
 }
 
+template <typename Stream>
 static PyObject *
-cXmlStream_writeCDATA(cXmlStream *self, PyObject *arg) {
+cXmlStream_writeCDATA(cBasicXmlStream<Stream> *self, PyObject *arg) {
     return cXmlStream_generic_string(*self->p_stream,
-                                     &XmlStream::writeCDATA,
+                                     &Stream::writeCDATA,
                                      arg);
 }
 
 /* The argumens must be a dict[str, dict[str, str]] */
+template <typename Stream>
 static PyObject *
-cXmlStream_writeCSS(cXmlStream *self, PyObject *arg) {
+cXmlStream_writeCSS(cBasicXmlStream<Stream> *self, PyObject *arg) {
     PyObject *ret = NULL;
     // Used for iterating across the dict
     PyObject *key, *value;
@@ -408,15 +1286,21 @@ cXmlStream_writeCSS(cXmlStream *self, PyObject *arg) {
                          __FUNCTION__, Py_TYPE(value)->tp_name);
             goto except;
         }
-        theCSSMap[CPythonCpp::py_utf8_to_std_string(key)] = \
-            CPythonCpp::py_dict_to_std_map(value,
-                                           &CPythonCpp::py_utf8_to_std_string,
-                                           &CPythonCpp::py_utf8_to_std_string);
+        std::string style = CPythonCpp::py_utf8_to_std_string(key);
+        if (PyErr_Occurred()) {
+            goto except;
+        }
+        py_dict_to_xml_attrs(value, theCSSMap[style]);
         if (PyErr_Occurred()) {
             goto except;
         }
     }
-    self->p_stream->writeCSS(theCSSMap);
+    try {
+        self->p_stream->writeCSS(theCSSMap);
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        goto except;
+    }
     assert(! PyErr_Occurred());
     Py_INCREF(Py_None);
     ret = Py_None;
@@ -429,15 +1313,187 @@ finally:
     return ret;
 }
 
+#pragma mark writeTree
+/* Write a node of writeTree(), a str or (name, attrs[, children]), and its
+ * descendants. The nodes are walked here so there is one call from Python
+ * for the whole subtree.
+ * On failure this sets PyErr_Occurred() and returns false, any elements
+ * opened are left open for the caller to close.
+ */
+template <typename Stream>
+static bool
+cXmlStream_write_node(cBasicXmlStream<Stream> *self, PyObject *node) {
+    bool ret = false;
+    bool entered = false;
+    PyObject *name = NULL;
+    PyObject *attrs = NULL;
+    PyObject *children = NULL;
+    XmlStringView view;
+    Py_ssize_t size = 0;
+    size_t depth = 0;
+    tAttrs *cpp_attrs = NULL;
+
+    if (PyUnicode_Check(node)) {
+        if (! py_str_to_view(node, view)) {
+            return false;
+        }
+        try {
+            self->p_stream->characters(view);
+        } catch (ExceptionXml &err) {
+            set_py_exception_from(err);
+            return false;
+        }
+        return true;
+    }
+    if (PyTuple_Check(node) || PyList_Check(node)) {
+        size = PySequence_Fast_GET_SIZE(node);
+    }
+    if (size != 2 && size != 3) {
+        PyErr_Format(PyExc_TypeError,
+                     "A node to writeTree() must be a str or a tuple or list of"
+                     " (name, attrs[, children]) not \"%s\" of length %zd",
+                     Py_TYPE(node)->tp_name, size);
+        return false;
+    }
+    // Keep these alive in case a sink changes a list.
+    name = PySequence_Fast_GET_ITEM(node, 0);
+    Py_INCREF(name);
+    attrs = PySequence_Fast_GET_ITEM(node, 1);
+    Py_INCREF(attrs);
+    if (size == 3) {
+        children = PySequence_Fast_GET_ITEM(node, 2);
+        Py_INCREF(children);
+    }
+    if (Py_EnterRecursiveCall(" in writeTree()")) {
+        goto except;
+    }
+    entered = true;
+    if (! py_str_to_view(name, view)) {
+        goto except;
+    }
+    cpp_attrs = cXmlStream_scratch_attrs(self);
+    if (! cpp_attrs) {
+        goto except;
+    }
+    if (attrs != Py_None) {
+        py_dict_to_xml_attrs(attrs, *cpp_attrs);
+        if (PyErr_Occurred()) {
+            goto except;
+        }
+    }
+    try {
+        self->p_stream->startElement(view, *cpp_attrs);
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        goto except;
+    }
+    depth = self->p_stream->depth();
+    if (children) {
+        if (PyUnicode_Check(children)) {
+            if (! cXmlStream_write_node(self, children)) {
+                goto except;
+            }
+        } else if (PyTuple_Check(children) || PyList_Check(children)) {
+            // The size is read each time in case a sink changes a list.
+            for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(children); ++i) {
+                PyObject *child = PySequence_Fast_GET_ITEM(children, i);
+                Py_INCREF(child);
+                bool written = cXmlStream_write_node(self, child);
+                Py_DECREF(child);
+                if (! written) {
+                    goto except;
+                }
+            }
+        } else {
+            PyErr_Format(PyExc_TypeError,
+                         "The children in writeTree() must be a str, tuple or list not \"%s\"",
+                         Py_TYPE(children)->tp_name);
+            goto except;
+        }
+    }
+    try {
+        self->p_stream->_endElementAt(depth);
+    } catch (ExceptionXmlEndElement &err) {
+        PyErr_SetString(Py_ExceptionXmlEndElement, err.message().c_str());
+        goto except;
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        goto except;
+    }
+    assert(! PyErr_Occurred());
+    ret = true;
+    goto finally;
+except:
+    assert(PyErr_Occurred());
+    ret = false;
+finally:
+    if (entered) {
+        Py_LeaveRecursiveCall();
+    }
+    Py_XDECREF(name);
+    Py_XDECREF(attrs);
+    Py_XDECREF(children);
+    return ret;
+}
+
+template <typename Stream>
+static PyObject *
+cXmlStream_writeTree(cBasicXmlStream<Stream> *self, PyObject *node) {
+    size_t depth = self->p_stream->depth();
+    if (cXmlStream_write_node(self, node)) {
+        Py_RETURN_NONE;
+    }
+    // Close the elements opened by this call as Element does on an
+    // exception, keeping the original exception.
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    try {
+        while (self->p_stream->depth() > depth) {
+            self->p_stream->_endElementAt(self->p_stream->depth());
+        }
+    } catch (ExceptionXml &) {
+        // The stream is already failing.
+    }
+    PyErr_Restore(type, value, traceback);
+    return NULL;
+}
+
+template <typename Stream>
+static PyObject *
+cXmlStream_execute(cBasicXmlStream<Stream> *self, PyObject *arg) {
+    if (! PyObject_TypeCheck(arg, &cCommandBufferType)) {
+        PyErr_Format(PyExc_TypeError,
+                     "Argument to execute() must be a CommandBuffer not \"%s\"",
+                     Py_TYPE(arg)->tp_name);
+        return NULL;
+    }
+    try {
+        self->p_stream->execute(*((cCommandBuffer *)arg)->p_commands);
+    } catch (ExceptionXmlEndElement &err) {
+        PyErr_SetString(Py_ExceptionXmlEndElement, err.message().c_str());
+        return NULL;
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+template <typename Stream>
 static PyObject *
-cXmlStream__indent(cXmlStream *self, PyObject *args) {
+cXmlStream__indent(cBasicXmlStream<Stream> *self, PyObject *args) {
     PyObject *ret = NULL;
     size_t offset = 0;
 
     if (! PyArg_ParseTuple(args, "|i", &offset)) {
         goto except;
     }
-    self->p_stream->_indent(offset);
+    try {
+        self->p_stream->_indent(offset);
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        goto except;
+    }
     assert(! PyErr_Occurred());
     Py_INCREF(Py_None);
     ret = Py_None;
@@ -450,26 +1506,44 @@ finally:
     return ret;
 }
 
+template <typename Stream>
 static PyObject*
-cXmlStream__closeElemIfOpen(cXmlStream *self) {
-    self->p_stream->_closeElemIfOpen();
+cXmlStream__closeElemIfOpen(cBasicXmlStream<Stream> *self) {
+    try {
+        self->p_stream->_closeElemIfOpen();
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    }
     Py_INCREF(Py_None);
     return Py_None;
 }
 
+template <typename Stream>
 static PyObject*
-cXmlStream___enter__(cXmlStream *self) {
+cXmlStream___enter__(cBasicXmlStream<Stream> *self) {
 #if XML_WRITE_DEBUG_TRACE
     std::cout << "cXmlStream___enter__() self: " << self;
     std::cout << " p_stream: " << self->p_stream << std::endl;
 #endif
-    self->p_stream->_enter();
+    try {
+        self->p_stream->_enter();
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    }
     Py_INCREF(self);
     return (PyObject *)self;
 }
 
+// __exit__ ignores its arguments.
+template <typename Stream>
 static PyObject*
-cXmlStream___exit__(cXmlStream *self, PyObject */* args */) {
+#if XML_WRITE_FASTCALL
+cXmlStream___exit__(cBasicXmlStream<Stream> *self, PyObject *const */* args */, Py_ssize_t /* nargs */) {
+#else
+cXmlStream___exit__(cBasicXmlStream<Stream> *self, PyObject */* args */) {
+#endif
 #if XML_WRITE_DEBUG_TRACE
 //    std::cout << "cXmlStream___exit__() self: " << self;
 //    std::cout << " p_stream: " << self->p_stream << std::endl;
@@ -479,69 +1553,227 @@ cXmlStream___exit__(cXmlStream *self, PyObject */* args */) {
     PyObject_Print(args, stdout, 0);
     fprintf(stdout, "\n");
 #endif
-    self->p_stream->_close();
+    try {
+        self->p_stream->_close();
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    }
     Py_RETURN_FALSE;
 }
 
+template <typename Stream>
+static PyObject*
+cXmlStream_reset(cBasicXmlStream<Stream> *self) {
+    try {
+        self->p_stream->reset();
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
 // Defines a macro that will reduce C&P errors.
 #define CXMLSTREAM_METHOD(name,flags) { \
     #name, \
-    (PyCFunction)cXmlStream_##name, flags, \
+    (PyCFunction)cXmlStream_##name<Stream>, flags, \
     DOCSTRING_XmlWrite_XmlStream_##name \
 }
 
-static PyMethodDef cXmlStream_methods[] = {
+/* The Python type of an XmlStream and its tables, one for each C++ stream
+ * type. tp_name is set by add_stream_types().
+ */
+template <typename Stream>
+struct cXmlStreamDefs {
+    static PyMethodDef methods[];
+    static PyMemberDef members[];
+    static PyBufferProcs as_buffer;
+    static PyGetSetDef properties[];
+    static PyTypeObject type;
+};
+
+template <typename Stream>
+PyMethodDef cXmlStreamDefs<Stream>::methods[] = {
     CXMLSTREAM_METHOD(getvalue, METH_NOARGS),
+    {"getvalue_bytes", (PyCFunction)cXmlStream_getvalue_bytes<Stream>, METH_NOARGS,
+        "Returns the document as UTF-8 bytes."},
+    {"getbuffer", (PyCFunction)cXmlStream_getbuffer<Stream>, METH_NOARGS,
+        "Returns a read only memoryview of the UTF-8 document without copying it.\n"
+        "Writing to the stream raises an ExceptionXml until the memoryview is released."},
+    {"writeTo", (PyCFunction)cXmlStream_writeTo<Stream>, METH_O,
+        "Writes the UTF-8 document to a file descriptor or an object with a fileno() method.\n"
+        "This avoids joining a large document into one string, any Python buffering is bypassed."},
+    {"drain", (PyCFunction)cXmlStream_drain<Stream>, METH_NOARGS,
+        "Returns the UTF-8 bytes written since the last drain() and releases their memory.\n"
+        "The result may end part way through a start tag, the concatenation of all\n"
+        "the results is the complete document."},
+    {"reset", (PyCFunction)cXmlStream_reset<Stream>, METH_NOARGS,
+        "Discard the document so that the stream can be reused, the memory is kept.\n"
+        "This raises an ExceptionXml if the stream is writing to a file."},
     CXMLSTREAM_METHOD(_flipIndent, METH_O),
     CXMLSTREAM_METHOD(xmlSpacePreserve, METH_NOARGS),
-    CXMLSTREAM_METHOD(startElement, METH_VARARGS | METH_KEYWORDS),
+    CXMLSTREAM_METHOD(startElement, XML_WRITE_METH_KEYWORDS),
     CXMLSTREAM_METHOD(characters, METH_O),
     CXMLSTREAM_METHOD(literal, METH_O),
-    CXMLSTREAM_METHOD(comment, METH_VARARGS | METH_KEYWORDS),
+    CXMLSTREAM_METHOD(comment, XML_WRITE_METH_KEYWORDS),
     CXMLSTREAM_METHOD(pI, METH_O),
     CXMLSTREAM_METHOD(endElement, METH_O),
     CXMLSTREAM_METHOD(writeECMAScript, METH_O),
     CXMLSTREAM_METHOD(writeCDATA, METH_O),
     CXMLSTREAM_METHOD(writeCSS, METH_O),
+    {"writeTree", (PyCFunction)cXmlStream_writeTree<Stream>, METH_O,
+        "Writes a subtree in one call. A node is either a str, written as characters,\n"
+        "or a tuple or list of (name, attrs[, children]) where attrs is a dict or None\n"
+        "and children is a str or a list or tuple of nodes.\n"
+        "The escaping and indentation are the same as startElement(), characters()\n"
+        "and endElement()."},
+    {"execute", (PyCFunction)cXmlStream_execute<Stream>, METH_O,
+        "Writes the operations recorded in a CommandBuffer. If this raises the\n"
+        "operations before the failing one have been written."},
     CXMLSTREAM_METHOD(_indent, METH_VARARGS),
     CXMLSTREAM_METHOD(_closeElemIfOpen, METH_NOARGS),
     CXMLSTREAM_METHOD(__enter__, METH_NOARGS),
-    CXMLSTREAM_METHOD(__exit__, METH_VARARGS),
+    CXMLSTREAM_METHOD(__exit__, XML_WRITE_METH_EXIT),
     { NULL, NULL, 0, NULL }  /* Sentinel */
 };
 
-static PyMemberDef cXmlStream_members[] = {
+template <typename Stream>
+PyMemberDef cXmlStreamDefs<Stream>::members[] = {
     { NULL, 0, 0, 0, NULL }  /* Sentinel */
 };
 
+#pragma mark XmlStream buffer protocol
+/* Exports the in memory document as read only bytes. The XmlBuffer is
+ * pinned until the buffer is released so that it can not move.
+ */
+template <typename Stream>
+static int
+cXmlStream_bf_getbuffer(cBasicXmlStream<Stream> *self, Py_buffer *view, int flags) {
+    try {
+        // Checks that there is no sink.
+        self->p_stream->getbuffer();
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        view->obj = NULL;
+        return -1;
+    }
+    const std::string &value = self->p_stream->output().pin();
+    if (PyBuffer_FillInfo(view, (PyObject *)self,
+                          const_cast<char *>(value.data()),
+                          value.size(), 1, flags) < 0) {
+        self->p_stream->output().unpin();
+        return -1;
+    }
+    return 0;
+}
+
+template <typename Stream>
+static void
+cXmlStream_bf_releasebuffer(cBasicXmlStream<Stream> *self, Py_buffer * /* view */) {
+    self->p_stream->output().unpin();
+}
+
+template <typename Stream>
+PyBufferProcs cXmlStreamDefs<Stream>::as_buffer = {
+    (getbufferproc)cXmlStream_bf_getbuffer<Stream>,
+    (releasebufferproc)cXmlStream_bf_releasebuffer<Stream>,
+};
+
 #pragma mark XmlStream properties
+template <typename Stream>
 static PyObject*
-cXmlStream_get_id(cXmlStream* self, void * /* closure */) {
+cXmlStream_get_id(cBasicXmlStream<Stream> *self, void * /* closure */) {
     return PyBytes_FromStringAndSize(self->p_stream->id().c_str(),
                                      self->p_stream->id().size());
 }
 
+template <typename Stream>
 static PyObject*
-cXmlStream_get__canIndent(cXmlStream* self, void * /* closure */) {
+cXmlStream_get__canIndent(cBasicXmlStream<Stream> *self, void * /* closure */) {
     return PyBool_FromLong(self->p_stream->_canIndent() ? 1L : 0L);
 }
 
+template <typename Stream>
+static PyObject*
+cXmlStream_get_sortAttributes(cBasicXmlStream<Stream> *self, void * /* closure */) {
+    return PyBool_FromLong(self->p_stream->sortAttributes() ? 1L : 0L);
+}
+
+template <typename Stream>
+static int
+cXmlStream_set_sortAttributes(cBasicXmlStream<Stream> *self, PyObject *value, void * /* closure */) {
+    int truth = 0;
+
+    if (! value) {
+        PyErr_SetString(PyExc_TypeError, "Can not delete \"sortAttributes\"");
+        return -1;
+    }
+    truth = PyObject_IsTrue(value);
+    if (truth < 0) {
+        return -1;
+    }
+    self->p_stream->sortAttributes(truth != 0);
+    return 0;
+}
+
+template <typename Stream>
+static PyObject*
+cXmlStream_get_indentString(cBasicXmlStream<Stream> *self, void * /* closure */) {
+    const std::string &indent = self->p_stream->indentString();
+    return PyUnicode_FromStringAndSize(indent.c_str(), indent.size());
+}
+
+template <typename Stream>
+static int
+cXmlStream_set_indentString(cBasicXmlStream<Stream> *self, PyObject *value, void * /* closure */) {
+    XmlStringView indent;
+
+    if (! value) {
+        PyErr_SetString(PyExc_TypeError, "Can not delete \"indentString\"");
+        return -1;
+    }
+    if (! py_str_to_view(value, indent)) {
+        return -1;
+    }
+    for (size_t i = 0; i < indent.size(); ++i) {
+        if (indent.data()[i] != ' ' && indent.data()[i] != '\t') {
+            PyErr_SetString(PyExc_ValueError,
+                            "\"indentString\" must only contain spaces and tabs");
+            return -1;
+        }
+    }
+    self->p_stream->indentString(indent.str());
+    return 0;
+}
+
 
-static PyGetSetDef cXmlStream_properties[] = {
-    {(char*)"id", (getter) cXmlStream_get_id, NULL,
+template <typename Stream>
+PyGetSetDef cXmlStreamDefs<Stream>::properties[] = {
+    {(char*)"id", (getter) cXmlStream_get_id<Stream>, NULL,
         (char*)"The current ID as bytes.", NULL },
-    {(char*)"_canIndent", (getter) cXmlStream_get__canIndent, NULL,
+    {(char*)"_canIndent", (getter) cXmlStream_get__canIndent<Stream>, NULL,
      (char*)"Returns True if indentation is possible (no mixed content etc.).",
         NULL },
+    {(char*)"sortAttributes", (getter) cXmlStream_get_sortAttributes<Stream>,
+        (setter) cXmlStream_set_sortAttributes<Stream>,
+        (char*)"True (the default) writes attributes sorted by name, False in the"
+        " order they were given. reset() restores True.", NULL },
+    {(char*)"indentString", (getter) cXmlStream_get_indentString<Stream>,
+        (setter) cXmlStream_set_indentString<Stream>,
+        (char*)"The string written once per level of indentation, spaces and tabs"
+        " only. The default is two spaces and reset() restores it. This is"
+        " always empty for the Fast streams that do not indent.", NULL },
     { NULL, NULL, NULL, NULL, NULL }  /* Sentinel */
 };
 
-static PyTypeObject cXmlStreamType = {
+template <typename Stream>
+PyTypeObject cXmlStreamDefs<Stream>::type = {
     PyVarObject_HEAD_INIT(NULL, 0)
-    "cXmlWrite.XmlStream",    /* tp_name */
-    sizeof(cXmlStream),        /* tp_basicsize */
+    0,                         /* tp_name */
+    sizeof(cBasicXmlStream<Stream>), /* tp_basicsize */
     0,                         /* tp_itemsize */
-    (destructor)cXmlStream_dealloc, /* tp_dealloc */
+    (destructor)cXmlStream_dealloc<Stream>, /* tp_dealloc */
     0,                         /* tp_print */
     0,                         /* tp_getattr */
     0,                         /* tp_setattr */
@@ -555,7 +1787,7 @@ static PyTypeObject cXmlStreamType = {
     0,                         /* tp_str */
     0,                         /* tp_getattro */
     0,                         /* tp_setattro */
-    0,                         /* tp_as_buffer */
+    &cXmlStreamDefs<Stream>::as_buffer, /* tp_as_buffer */
     Py_TPFLAGS_DEFAULT |
         Py_TPFLAGS_BASETYPE,   /* tp_flags */
     DOCSTRING_XmlWrite_XmlStream, /* tp_doc */
@@ -565,17 +1797,17 @@ static PyTypeObject cXmlStreamType = {
     0,                         /* tp_weaklistoffset */
     0,                         /* tp_iter */
     0,                         /* tp_iternext */
-    cXmlStream_methods,        /* tp_methods */
-    cXmlStream_members,        /* tp_members */
-    cXmlStream_properties,     /* tp_getset */
+    cXmlStreamDefs<Stream>::methods, /* tp_methods */
+    cXmlStreamDefs<Stream>::members, /* tp_members */
+    cXmlStreamDefs<Stream>::properties, /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
     0,                         /* tp_descr_set */
     0,                         /* tp_dictoffset */
-    (initproc)Generic_Stream_init<cXmlStream, XmlStream>, /* tp_init */
+    (initproc)Generic_Stream_init<cBasicXmlStream<Stream>, Stream>, /* tp_init */
     0,                         /* tp_alloc */
-    cXmlStream_new,            /* tp_new */
+    cXmlStream_new<Stream>,    /* tp_new */
     0,                         /* tp_free */
     0,                         /* tp_is_gc */
     0,                         /* tp_bases */
@@ -588,27 +1820,30 @@ static PyTypeObject cXmlStreamType = {
     0,                         /* tp_finalise */
 };
 
-#define Py_cXmlStreamType_CheckExact(op) (Py_TYPE(op) == &cXmlStreamType)
-#define Py_cXmlStreamType_Check(op) PyObject_TypeCheck(op, &cXmlStreamType)
-
 /******************* END: XmlStream ********************/
 
 #pragma mark -
 #pragma mark XhtmlStream
 /******************* XhtmlStream ********************/
 
-typedef struct : cXmlStream {
-//    cXmlStream xmlstream;
-} cXhtmlStream;
+template <typename Stream>
+struct cBasicXhtmlStream : cBasicXmlStream<Stream> {
+};
 
+template <typename Stream>
 static PyObject *
-cXhtmlStream_charactersWithBr(cXhtmlStream *self, PyObject *arg) {
+cXhtmlStream_charactersWithBr(cBasicXhtmlStream<Stream> *self, PyObject *arg) {
     PyObject *ret = NULL;
-    std::string chars { CPythonCpp::py_utf8_to_std_string(arg) };
-    if (PyErr_Occurred()) {
+    XmlStringView chars;
+    if (! py_str_to_view(arg, chars)) {
+        goto except;
+    }
+    try {
+        ((BasicXhtmlStream<Stream> *)self->p_stream)->charactersWithBr(chars);
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
         goto except;
     }
-    ((XhtmlStream*)self->p_stream)->charactersWithBr(chars);
     assert(! PyErr_Occurred());
     Py_INCREF(Py_None);
     ret = Py_None;
@@ -621,29 +1856,48 @@ finally:
     return ret;
 }
 
+template <typename Stream>
 static PyObject*
-cXhtmlStream__enter(cXhtmlStream *self) {
-    ((XhtmlStream*)self->p_stream)->_enter();
+cXhtmlStream__enter(cBasicXhtmlStream<Stream> *self) {
+    try {
+        ((BasicXhtmlStream<Stream> *)self->p_stream)->_enter();
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    }
     Py_INCREF(self);
     return (PyObject *)self;
 }
 
-static PyMemberDef cXhtmlStream_members[] = {
+/* As cXmlStreamDefs for an XhtmlStream, tp_base is set by
+ * add_stream_types().
+ */
+template <typename Stream>
+struct cXhtmlStreamDefs {
+    static PyMemberDef members[];
+    static PyMethodDef methods[];
+    static PyTypeObject type;
+};
+
+template <typename Stream>
+PyMemberDef cXhtmlStreamDefs<Stream>::members[] = {
     { NULL, 0, 0, 0, NULL }  /* Sentinel */
 };
 
-static PyMethodDef cXhtmlStream_methods[] = {
-    {"charactersWithBr", (PyCFunction)cXhtmlStream_charactersWithBr, METH_O,
+template <typename Stream>
+PyMethodDef cXhtmlStreamDefs<Stream>::methods[] = {
+    {"charactersWithBr", (PyCFunction)cXhtmlStream_charactersWithBr<Stream>, METH_O,
         PyDoc_STR(DOCSTRING_XmlWrite_XhtmlStream_charactersWithBr)},
-    {"__enter__", (PyCFunction)cXhtmlStream__enter, METH_NOARGS,
+    {"__enter__", (PyCFunction)cXhtmlStream__enter<Stream>, METH_NOARGS,
         DOCSTRING_XmlWrite_XhtmlStream___enter__},
     {NULL, NULL, 0, NULL},
 };
 
-static PyTypeObject cXhtmlStreamType = {
+template <typename Stream>
+PyTypeObject cXhtmlStreamDefs<Stream>::type = {
     PyVarObject_HEAD_INIT(NULL, 0)
-    "cXmlWrite.cXhtmlStream",    /* tp_name */
-    sizeof(cXhtmlStream),        /* tp_basicsize */
+    0,                         /* tp_name */
+    sizeof(cBasicXhtmlStream<Stream>), /* tp_basicsize */
     0,                         /* tp_itemsize */
     0,                         /* tp_dealloc */
     0,                         /* tp_print */
@@ -669,8 +1923,8 @@ static PyTypeObject cXhtmlStreamType = {
     0,                         /* tp_weaklistoffset */
     0,                         /* tp_iter */
     0,                         /* tp_iternext */
-    cXhtmlStream_methods,      /* tp_methods */
-    cXhtmlStream_members,      /* tp_members */
+    cXhtmlStreamDefs<Stream>::methods, /* tp_methods */
+    cXhtmlStreamDefs<Stream>::members, /* tp_members */
     0,                         /* tp_getset */
     /* Assign at module initialisation time. */
     0,                         /* tp_base */
@@ -678,7 +1932,7 @@ static PyTypeObject cXhtmlStreamType = {
     0,                         /* tp_descr_get */
     0,                         /* tp_descr_set */
     0,                         /* tp_dictoffset */
-    (initproc)Generic_Stream_init<cXhtmlStream, XhtmlStream>, /* tp_init */
+    (initproc)Generic_Stream_init<cBasicXhtmlStream<Stream>, BasicXhtmlStream<Stream>>, /* tp_init */
     0,                         /* tp_alloc */
     0,                         /* tp_new */
     0,                         /* tp_free */
@@ -693,142 +1947,294 @@ static PyTypeObject cXhtmlStreamType = {
     0,                         /* tp_finalise */
 };
 
-#define Py_cXhtmlStreamType_CheckExact(op) (Py_TYPE(op) == &cXhtmlStreamType)
-#define Py_cXhtmlStreamType_Check(op) PyObject_TypeCheck(op, &cXhtmlStreamType)
 /**************** END: XhtmlStream ******************/
 
 #pragma mark -
 #pragma mark Element
 /******************* Element ********************/
-typedef struct {
+/* The start tag is written by __enter__ so until then this holds the name
+ * and attributes, afterwards only the depth of the element in the stream.
+ */
+template <typename Stream>
+struct cBasicElement {
     PyObject_HEAD
-    Element *p_element;
-} cElement;
+    /* A cBasicXmlStream or cBasicXhtmlStream of the same Stream, this holds
+     * a reference. */
+    PyObject *stream;
+    Stream *p_stream;
+    PyObject *name;
+    /* A dict or NULL. */
+    PyObject *attrs;
+    /* Zero until entered. */
+    size_t depth;
+};
+
+static const size_t ELEMENT_FREELIST_SIZE = 64;
+
+/* As cXmlStreamDefs for an Element.
+ *
+ * Freed Element objects, of exactly this type, are kept in the freelist for
+ * reuse so that a with Element(...) loop does not allocate. Subclass
+ * instances are always freed. This is protected by the GIL.
+ */
+template <typename Stream>
+struct cElementDefs {
+    static PyMethodDef methods[];
+    static PyMemberDef members[];
+    static PyTypeObject type;
+    static cBasicElement<Stream> *freelist[ELEMENT_FREELIST_SIZE];
+    static size_t freelist_count;
+};
+
+template <typename Stream>
+cBasicElement<Stream> *cElementDefs<Stream>::freelist[ELEMENT_FREELIST_SIZE];
 
+template <typename Stream>
+size_t cElementDefs<Stream>::freelist_count = 0;
+
+template <typename Stream>
+static void
+cElement_freelist_clear() {
+    typedef cElementDefs<Stream> Defs;
+    while (Defs::freelist_count) {
+        PyObject_Del(Defs::freelist[--Defs::freelist_count]);
+    }
+}
+
+template <typename Stream>
 static void
-cElement_dealloc(cElement* self) {
-    delete self->p_element;
+cElement_dealloc(cBasicElement<Stream> *self) {
+    Py_XDECREF(self->stream);
+    Py_XDECREF(self->name);
+    Py_XDECREF(self->attrs);
+    typedef cElementDefs<Stream> Defs;
+    // Only exactly this type, a subclass may be larger.
+    if (Py_TYPE(self) == &Defs::type
+        && Defs::freelist_count < ELEMENT_FREELIST_SIZE) {
+        Defs::freelist[Defs::freelist_count++] = self;
+        return;
+    }
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
+template <typename Stream>
 static PyObject *
 cElement_new(PyTypeObject *type, PyObject */* args */, PyObject */* kwds */) {
-    cElement *self = (cElement *)type->tp_alloc(type, 0);
+    typedef cElementDefs<Stream> Defs;
+    cBasicElement<Stream> *self;
+    if (type == &Defs::type && Defs::freelist_count) {
+        self = Defs::freelist[--Defs::freelist_count];
+        // Sets the type and a reference count of 1.
+        PyObject_Init((PyObject *)self, type);
+    } else {
+        self = (cBasicElement<Stream> *)type->tp_alloc(type, 0);
+    }
     if (self != NULL) {
-        self->p_element = nullptr;
+        self->stream = NULL;
+        self->p_stream = nullptr;
+        self->name = NULL;
+        self->attrs = NULL;
+        self->depth = 0;
     }
     return (PyObject *)self;
 }
 
+static const char *cElement_kwlist[] = {
+    "theXmlStream", "theName", "theAttrs", NULL
+};
+
+/* Check and set the arguments to Element(), attributes may be NULL. */
+template <typename Stream>
 static int
-cElement_init(cElement *self, PyObject *args, PyObject *kwds) {
-    int ret = 0;
-    PyObject *stream = NULL;
-    const char *name;
-    static CPythonCpp::DefaultArg attributes { PyDict_New() };
+cElement_set(cBasicElement<Stream> *self, PyObject *stream, PyObject *name, PyObject *attributes) {
+    Stream *p_stream = nullptr;
 
-    if (!attributes) {
+    if (Py_TYPE(stream) == &cXmlStreamDefs<Stream>::type
+        || Py_TYPE(stream) == &cXhtmlStreamDefs<Stream>::type) {
+        p_stream = ((cBasicXmlStream<Stream> *)stream)->p_stream;
+    } else {
+        PyErr_Format(PyExc_TypeError,
+                     "Value of \"theXmlStream\" to %s must be %s not \"%s\"",
+                     Py_TYPE(self)->tp_name, cXmlStreamDefs<Stream>::type.tp_name,
+                     Py_TYPE(stream)->tp_name);
         return -1;
     }
-    static const char *kwlist[] = {
-        "theXmlStream", "theName", "theAttrs", NULL
-    };
-
-    if (! PyArg_ParseTupleAndKeywords(args, kwds, "Os|O",
-                                      const_cast<char**>(kwlist),
-                                      &stream, &name, &attributes)) {
+    if (! PyUnicode_Check(name)) {
+        PyErr_Format(PyExc_TypeError,
+                     "Value of \"theName\" to %s must be str not \"%s\"",
+                     __FUNCTION__, Py_TYPE(name)->tp_name);
         return -1;
     }
-    assert(self->p_element == nullptr);
-    if (Py_cXmlStreamType_CheckExact(stream)) {
-        cXmlStream *xml_stream = (cXmlStream*)stream;
-        self->p_element = new Element(*xml_stream->p_stream,
-                                      std::string(name),
-                                      CPythonCpp::py_dict_to_std_map(
-                                          attributes,
-                                          &CPythonCpp::py_utf8_to_std_string,
-                                          &CPythonCpp::py_utf8_to_std_string)
-                                      );
-    } else if (Py_cXhtmlStreamType_CheckExact(stream)) {
-        cXhtmlStream *xml_stream = (cXhtmlStream*)stream;
-        self->p_element = new Element(*xml_stream->p_stream,
-                                      std::string(name),
-                                      CPythonCpp::py_dict_to_std_map(
-                                          attributes,
-                                          &CPythonCpp::py_utf8_to_std_string,
-                                          &CPythonCpp::py_utf8_to_std_string)
-                                      );
-    } else {
+    if (attributes == Py_None) {
+        attributes = NULL;
+    }
+    if (attributes && ! PyDict_Check(attributes)) {
         PyErr_Format(PyExc_TypeError,
-                     "Value of \"theXmlStream\" to %s must be cXmlStream not \"%s\"",
-                     __FUNCTION__, Py_TYPE(stream)->tp_name);
+                     "Value of \"theAttrs\" to %s must be dict not \"%s\"",
+                     __FUNCTION__, Py_TYPE(attributes)->tp_name);
         return -1;
     }
-    if (PyErr_Occurred()) {
+    Py_INCREF(stream);
+    Py_XDECREF(self->stream);
+    self->stream = stream;
+    self->p_stream = p_stream;
+    Py_INCREF(name);
+    Py_XDECREF(self->name);
+    self->name = name;
+    Py_XINCREF(attributes);
+    Py_XDECREF(self->attrs);
+    self->attrs = attributes;
+    self->depth = 0;
+    return 0;
+}
+
+template <typename Stream>
+static int
+cElement_init(cBasicElement<Stream> *self, PyObject *args, PyObject *kwds) {
+    PyObject *stream = NULL;
+    PyObject *name = NULL;
+    PyObject *attributes = NULL;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "OO|O",
+                                      const_cast<char**>(cElement_kwlist),
+                                      &stream, &name, &attributes)) {
         return -1;
     }
-    if (! self->p_element) {
-        ret =  -1;
+    return cElement_set(self, stream, name, attributes);
+}
+
+#if XML_WRITE_VECTORCALL
+/* Element(...) without tp_new and tp_init, so no argument tuple. This is
+ * only used for Element itself as tp_vectorcall is not inherited.
+ */
+template <typename Stream>
+static PyObject *
+cElement_vectorcall(PyObject *type, PyObject *const *args,
+                    size_t nargsf, PyObject *kwnames) {
+    PyObject *values[3] = { NULL, NULL, NULL };
+    if (! unpack_fastcall_args("Element", cElement_kwlist, 2, args,
+                               PyVectorcall_NARGS(nargsf), kwnames, values)) {
+        return NULL;
     }
-    return ret;
+    PyObject *self = cElement_new<Stream>((PyTypeObject *)type, NULL, NULL);
+    if (! self) {
+        return NULL;
+    }
+    if (cElement_set((cBasicElement<Stream> *)self, values[0], values[1], values[2])) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    return self;
 }
+#endif
 
+template <typename Stream>
 static PyObject *
-cElement__close(cElement *self) {
-    self->p_element->_close();
+cElement__close(cBasicElement<Stream> *self) {
+    if (! self->p_stream) {
+        PyErr_SetString(PyExc_RuntimeError, "Element has not been initialised.");
+        return NULL;
+    }
+    try {
+        self->p_stream->_endElementAt(self->depth);
+        self->depth = 0;
+    } catch (ExceptionXmlEndElement &err) {
+        PyErr_SetString(Py_ExceptionXmlEndElement, err.message().c_str());
+        return NULL;
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    }
     Py_INCREF(Py_None);
     return Py_None;
 }
 
+template <typename Stream>
 static PyObject*
-cElement___enter__(cElement *self) {
+cElement___enter__(cBasicElement<Stream> *self) {
+    XmlStringView cpp_name;
 #if XML_WRITE_DEBUG_TRACE
     std::cout << "cElement___enter__() self: " << self;
-    std::cout << " p_stream: " << self->p_element << std::endl;
+    std::cout << " p_stream: " << self->p_stream << std::endl;
 #endif
-    self->p_element->_enter();
+    if (! self->p_stream) {
+        PyErr_SetString(PyExc_RuntimeError, "Element has not been initialised.");
+        return NULL;
+    }
+    if (! py_str_to_view(self->name, cpp_name)) {
+        return NULL;
+    }
+    // The stream is a cBasicXmlStream or cBasicXhtmlStream, see cElement_set().
+    tAttrs *cpp_attrs = cXmlStream_scratch_attrs((cBasicXmlStream<Stream> *)self->stream);
+    if (! cpp_attrs) {
+        return NULL;
+    }
+    if (self->attrs) {
+        py_dict_to_xml_attrs(self->attrs, *cpp_attrs);
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+    }
+    try {
+        self->p_stream->startElement(cpp_name, *cpp_attrs);
+    } catch (ExceptionXml &err) {
+        set_py_exception_from(err);
+        return NULL;
+    }
+    self->depth = self->p_stream->depth();
     Py_INCREF(self);
     return (PyObject *)self;
 }
 
+// __exit__ ignores its arguments.
+template <typename Stream>
 static PyObject*
-cElement___exit__(cElement *self, PyObject */* args */) {
+#if XML_WRITE_FASTCALL
+cElement___exit__(cBasicElement<Stream> *self, PyObject *const */* args */, Py_ssize_t /* nargs */) {
+#else
+cElement___exit__(cBasicElement<Stream> *self, PyObject */* args */) {
+#endif
 #if XML_WRITE_DEBUG_TRACE
     fprintf(stdout, "cElement___exit__() self: %p", self);
-    fprintf(stdout, " p_element: %p", self->p_element);
+    fprintf(stdout, " depth: %zu", self->depth);
     fprintf(stdout, " args: ");
     PyObject_Print(args, stdout, 0);
     fprintf(stdout, "\n");
 #endif
-    self->p_element->_close();
+    PyObject *ret = cElement__close(self);
+    if (! ret) {
+        return NULL;
+    }
+    Py_DECREF(ret);
     Py_RETURN_FALSE;
 }
 
-static PyMethodDef cElement_methods[] = {
-    {"_close", (PyCFunction)cElement__close, METH_NOARGS,
+template <typename Stream>
+PyMethodDef cElementDefs<Stream>::methods[] = {
+    {"_close", (PyCFunction)cElement__close<Stream>, METH_NOARGS,
         "Close the element."
     },
-    {"__enter__", (PyCFunction)cElement___enter__, METH_NOARGS,
+    {"__enter__", (PyCFunction)cElement___enter__<Stream>, METH_NOARGS,
         "Enter the element."
     },
-    {"__exit__", (PyCFunction)cElement___exit__, METH_VARARGS,
+    {"__exit__", (PyCFunction)cElement___exit__<Stream>, XML_WRITE_METH_EXIT,
         "Exit the element."
     },
     { NULL, NULL, 0, NULL }  /* Sentinel */
 };
 
-static PyMemberDef cElement_members[] = {
-//    {"first", T_OBJECT_EX, offsetof(cXmlStream, first), 0,
-//        "first name"},
+template <typename Stream>
+PyMemberDef cElementDefs<Stream>::members[] = {
     { NULL, 0, 0, 0, NULL }  /* Sentinel */
 };
 
-static PyTypeObject cElementType = {
+template <typename Stream>
+PyTypeObject cElementDefs<Stream>::type = {
     PyVarObject_HEAD_INIT(NULL, 0)
-    "cXmlWrite.Element",       /* tp_name */
-    sizeof(cElement),          /* tp_basicsize */
+    0,                         /* tp_name */
+    sizeof(cBasicElement<Stream>), /* tp_basicsize */
     0,                         /* tp_itemsize */
-    (destructor)cElement_dealloc, /* tp_dealloc */
+    (destructor)cElement_dealloc<Stream>, /* tp_dealloc */
     0,                         /* tp_print */
     0,                         /* tp_getattr */
     0,                         /* tp_setattr */
@@ -852,17 +2258,17 @@ static PyTypeObject cElementType = {
     0,                         /* tp_weaklistoffset */
     0,                         /* tp_iter */
     0,                         /* tp_iternext */
-    cElement_methods,          /* tp_methods */
-    cElement_members,          /* tp_members */
+    cElementDefs<Stream>::methods, /* tp_methods */
+    cElementDefs<Stream>::members, /* tp_members */
     0,                         /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
     0,                         /* tp_descr_set */
     0,                         /* tp_dictoffset */
-    (initproc)cElement_init,   /* tp_init */
+    (initproc)cElement_init<Stream>, /* tp_init */
     0,                         /* tp_alloc */
-    cElement_new,              /* tp_new */
+    cElement_new<Stream>,      /* tp_new */
     0,                         /* tp_free */
     0,                         /* tp_is_gc */
     0,                         /* tp_bases */
@@ -880,6 +2286,55 @@ static PyTypeObject cElementType = {
 #pragma mark Module
 /******************* Module ********************/
 
+static void
+cXmlWritemodule_free(void */* module */) {
+    XmlBlockingSection::setHooks(nullptr, nullptr);
+    cElement_freelist_clear<XmlStream>();
+    cElement_freelist_clear<XmlStreamFast>();
+    stream_pool_clear<XmlStream>();
+    stream_pool_clear<XhtmlStream>();
+    stream_pool_clear<XmlStreamFast>();
+    stream_pool_clear<XhtmlStreamFast>();
+}
+
+/* Adds a type to the module as the part of the qualified name tp_name after
+ * the last '.', tp_name must be static. Returns -1 on failure.
+ */
+static int
+add_type(PyObject *m, PyTypeObject *type, const char *tp_name) {
+    type->tp_name = tp_name;
+    if (PyType_Ready(type) < 0) {
+        return -1;
+    }
+    Py_INCREF(type);
+    if (PyModule_AddObject(m, strrchr(tp_name, '.') + 1, (PyObject *)type) < 0) {
+        Py_DECREF(type);
+        return -1;
+    }
+    return 0;
+}
+
+/* Adds the XmlStream, XhtmlStream and Element types for one C++ stream type.
+ * Returns -1 on failure.
+ */
+template <typename Stream>
+static int
+add_stream_types(PyObject *m, const char *xml_name, const char *xhtml_name,
+                 const char *element_name) {
+    if (add_type(m, &cXmlStreamDefs<Stream>::type, xml_name)) {
+        return -1;
+    }
+    // Assign base object first.
+    cXhtmlStreamDefs<Stream>::type.tp_base = &cXmlStreamDefs<Stream>::type;
+    if (add_type(m, &cXhtmlStreamDefs<Stream>::type, xhtml_name)) {
+        return -1;
+    }
+#if XML_WRITE_VECTORCALL
+    cElementDefs<Stream>::type.tp_vectorcall = cElement_vectorcall<Stream>;
+#endif
+    return add_type(m, &cElementDefs<Stream>::type, element_name);
+}
+
 static PyMethodDef cXmlWritemodule_methods[] = {
     /* Other functions here... */
     { "encodeString", (PyCFunction)encode_string, METH_VARARGS | METH_KEYWORDS,
@@ -898,7 +2353,8 @@ static PyModuleDef cXmlWritemodule = {
     "cXmlWrite has C++ XML support with a CPython wrapper.",
     -1,
     cXmlWritemodule_methods,
-    NULL, NULL, NULL, NULL
+    NULL, NULL, NULL,
+    (freefunc)cXmlWritemodule_free
 };
 
 __attribute__((visibility("default")))
@@ -935,31 +2391,26 @@ PyInit_cXmlWrite(void) {
         return NULL;
     }
 
-    // Prepare and add types
-    // cXmlStreamType
-    if (PyType_Ready(&cXmlStreamType) < 0) {
-        return NULL;
-    }
-    Py_INCREF(&cXmlStreamType);
-    PyModule_AddObject(m, "XmlStream", (PyObject *)&cXmlStreamType);
+    XmlBlockingSection::setHooks(blocking_section_begin, blocking_section_end);
 
-    // cXhtmlStreamType
-    // Assign base object first.
-    cXhtmlStreamType.tp_base = &cXmlStreamType;
-    if (PyType_Ready(&cXhtmlStreamType) < 0) {
+    // Prepare and add types
+    if (add_stream_types<XmlStream>(m, "cXmlWrite.XmlStream", "cXmlWrite.XhtmlStream",
+                                    "cXmlWrite.Element")) {
         return NULL;
     }
-    Py_INCREF(&cXhtmlStreamType);
-    PyModule_AddObject(m, "XhtmlStream", (PyObject *)&cXhtmlStreamType);
-    if (PyType_Ready(&cXhtmlStreamType) < 0) {
+    // These do not indent or check end element names, the output is
+    // otherwise the same.
+    if (add_stream_types<XmlStreamFast>(m, "cXmlWrite.XmlStreamFast",
+                                        "cXmlWrite.XhtmlStreamFast",
+                                        "cXmlWrite.ElementFast")) {
         return NULL;
     }
-    // cElementType
-    if (PyType_Ready(&cElementType) < 0) {
+    // cCommandBufferType
+    if (PyType_Ready(&cCommandBufferType) < 0) {
         return NULL;
     }
-    Py_INCREF(&cElementType);
-    PyModule_AddObject(m, "Element", (PyObject *)&cElementType);
+    Py_INCREF(&cCommandBufferType);
+    PyModule_AddObject(m, "CommandBuffer", (PyObject *)&cCommandBufferType);
 
     return m;
 }
@@ -2,222 +2,689 @@
 #include <pybind11/stl.h>
 
 #include "XmlWrite.h"
+#include "XmlSinkZlib.h"
 #include "XmlWrite_docs.h"
 
 namespace py = pybind11;
 
+namespace pybind11 { namespace detail {
+/**
+ * Convert between a dict[str, str] and XmlAttrs, attributes are added in
+ * dict order.
+ */
+template <> struct type_caster<XmlAttrs> {
+public:
+    PYBIND11_TYPE_CASTER(XmlAttrs, _("Dict[str, str]"));
+
+    bool load(handle src, bool convert) {
+        if (! isinstance<dict>(src)) {
+            return false;
+        }
+        dict d = reinterpret_borrow<dict>(src);
+        value.clear();
+        for (auto item: d) {
+            make_caster<std::string> key_caster;
+            make_caster<std::string> val_caster;
+            if (! key_caster.load(item.first, convert) ||
+                ! val_caster.load(item.second, convert)) {
+                return false;
+            }
+            // Dict keys are unique.
+            value.add(cast_op<std::string &>(key_caster),
+                      cast_op<std::string &>(val_caster));
+        }
+        return true;
+    }
+
+    static handle cast(const XmlAttrs &src, return_value_policy /* policy */,
+                       handle /* parent */) {
+        dict d;
+        for (size_t i = 0; i < src.size(); ++i) {
+            XmlStringView name = src.name(i);
+            XmlStringView val = src.value(i);
+            d[str(name.data(), name.size())] = str(val.data(), val.size());
+        }
+        return d.release();
+    }
+};
+/**
+ * A str argument as an XmlStringView of its UTF-8 representation. This is
+ * cached by the str so there is no copy, the view is valid for the duration
+ * of the call.
+ */
+template <> struct type_caster<XmlStringView> {
+public:
+    PYBIND11_TYPE_CASTER(XmlStringView, _("str"));
+
+    bool load(handle src, bool /* convert */) {
+        if (! PyUnicode_Check(src.ptr())) {
+            return false;
+        }
+        Py_ssize_t size;
+        const char *data = PyUnicode_AsUTF8AndSize(src.ptr(), &size);
+        if (! data) {
+            PyErr_Clear();
+            return false;
+        }
+        value = XmlStringView(data, static_cast<size_t>(size));
+        return true;
+    }
+
+    static handle cast(const XmlStringView &src, return_value_policy /* policy */,
+                       handle /* parent */) {
+        return str(src.data(), src.size()).release();
+    }
+};
+}} // namespace pybind11::detail
+
+/**
+ * A sink that calls the write() method of a Python file like object with
+ * str for an io.TextIOBase or bytes otherwise.
+ */
+class PybSinkFile : public XmlSinkUtf8 {
+public:
+    PybSinkFile(py::object theFile) : _write(theFile.attr("write")) {
+        _is_text = py::isinstance(theFile,
+                                  py::module::import("io").attr("TextIOBase"));
+    }
+protected:
+    void writeUtf8(const char *data, size_t len) override {
+        if (_is_text) {
+            _write(py::str(data, len));
+        } else {
+            _write(py::bytes(data, len));
+        }
+    }
+    py::object _write;
+    bool _is_text;
+};
+
+// Hooks for XmlBlockingSection so that the GIL is released while a sink
+// blocks. Background threads do not hold the GIL so nothing is done for them.
+static void *blocking_section_begin() {
+    if (! PyGILState_Check()) {
+        return nullptr;
+    }
+    return PyEval_SaveThread();
+}
+
+static void blocking_section_end(void *state) {
+    if (state) {
+        PyEval_RestoreThread(static_cast<PyThreadState *>(state));
+    }
+}
+
+/**
+ * Create a sink from the "theFile" argument. This can be None for an in
+ * memory stream, an int that is an open file descriptor, an object with a
+ * write() method or a str or os.PathLike that is the path of a file to create.
+ */
+static std::unique_ptr<XmlSink> make_sink(py::object theFile) {
+    if (theFile.is_none()) {
+        return nullptr;
+    }
+    if (py::isinstance<py::bool_>(theFile)) {
+        throw py::type_error("Argument \"theFile\" must not be a bool");
+    }
+    if (py::isinstance<py::int_>(theFile)) {
+        // This raises for a negative value or one that overflows an int.
+        int fd = PyObject_AsFileDescriptor(theFile.ptr());
+        if (fd < 0) {
+            throw py::error_already_set();
+        }
+        return std::unique_ptr<XmlSink>(new XmlSinkFd(fd));
+    }
+    if (! py::isinstance<py::str>(theFile) && py::hasattr(theFile, "write")) {
+        return std::unique_ptr<XmlSink>(new PybSinkFile(theFile));
+    }
+    py::object path = py::module::import("os").attr("fspath")(theFile);
+    if (py::isinstance<py::bytes>(path)) {
+        return std::unique_ptr<XmlSink>(new XmlSinkFd(std::string(py::bytes(path))));
+    }
+    return std::unique_ptr<XmlSink>(new XmlSinkFd(path.cast<std::string>()));
+}
+
+// As above, if compression is "gzip" or "zlib" the output is compressed, by
+// compressionThreads threads if not 1, 0 is one thread per core, in blocks
+// of compressionBlockSize. If
+// background is true the file is written, and compressed, by a thread. This
+// needs a file descriptor or path as the thread can not call Python.
+static std::unique_ptr<XmlSink> make_sink(py::object theFile, bool background,
+                                          py::object compression,
+                                          int compressionLevel,
+                                          size_t compressionSyncSize,
+                                          size_t compressionThreads,
+                                          size_t compressionBlockSize) {
+    // Each block of the threads ends with a sync flush so a sync size only
+    // applies to one thread and a block size only to several.
+    if (compressionThreads == 1 && compressionBlockSize) {
+        throw py::value_error(
+            "Argument \"compressionBlockSize\" needs \"compressionThreads\" other than 1");
+    }
+    if (compressionThreads != 1 && compressionSyncSize) {
+        throw py::value_error(
+            "Argument \"compressionSyncSize\" needs \"compressionThreads\" of 1");
+    }
+    std::unique_ptr<XmlSink> sink = make_sink(theFile);
+    bool is_fd = dynamic_cast<XmlSinkFd *>(sink.get()) != nullptr;
+    if (! compression.is_none()) {
+        std::string name = compression.cast<std::string>();
+        XmlSinkZlib::Format format;
+        if (name == "gzip") {
+            format = XmlSinkZlib::FORMAT_GZIP;
+        } else if (name == "zlib") {
+            format = XmlSinkZlib::FORMAT_ZLIB;
+        } else {
+            throw py::value_error(
+                "Argument \"compression\" must be \"gzip\", \"zlib\" or None not \""
+                + name + "\"");
+        }
+        if (! sink) {
+            throw py::value_error("Argument \"compression\" needs \"theFile\"");
+        }
+        if (compressionThreads == 1) {
+            sink.reset(new XmlSinkZlib(std::move(sink), compressionLevel, format,
+                                       compressionSyncSize));
+        } else {
+            sink.reset(new XmlSinkZlibParallel(std::move(sink), compressionLevel, format,
+                                               compressionThreads, compressionBlockSize));
+        }
+    }
+    if (background) {
+        if (! is_fd) {
+            throw py::value_error(
+                "Argument \"background\" needs \"theFile\" to be a file descriptor or path");
+        }
+        sink.reset(new XmlSinkThread(std::move(sink)));
+    }
+    return sink;
+}
+
 /**
  * Specialise the underlying C++ code for supporting Python context manager
  * __exit__ calls with pybind11 techniques.
  * This keeps the seperation of pure C++ and pybind11 clean.
+ * Stream is XmlStream or XmlStreamFast.
  */
-class PybXmlStream : public XmlStream {
+template <typename Stream>
+class PybBasicXmlStream : public Stream {
 public:
-    PybXmlStream(const std::string &theEnc/* ='utf-8'*/,
-                 const std::string &theDtdLocal /* =None */,
-                 int theId /* =0 */,
-                 bool mustIndent /* =True */) : XmlStream(theEnc, theDtdLocal, theId, mustIndent) {}
-    PybXmlStream &_enter() {
-        XmlStream::_enter();
+    PybBasicXmlStream(const std::string &theEnc/* ='utf-8'*/,
+                      const std::string &theDtdLocal /* =None */,
+                      int theId /* =0 */,
+                      bool mustIndent /* =True */,
+                      py::object theFile /* =None */,
+                      size_t flushSize,
+                      size_t sizeHint /* =0 */,
+                      const std::string &profile /* ='' */,
+                      bool background /* =False */,
+                      py::object compression /* =None */,
+                      int compressionLevel /* =-1 */,
+                      size_t compressionSyncSize /* =0 */,
+                      size_t compressionThreads /* =1 */,
+                      size_t compressionBlockSize /* =0 */) : Stream(theEnc, theDtdLocal,
+                                                             theId, mustIndent,
+                                                             make_sink(theFile, background,
+                                                                       compression,
+                                                                       compressionLevel,
+                                                                       compressionSyncSize,
+                                                                       compressionThreads,
+                                                                       compressionBlockSize),
+                                                             flushSize, sizeHint,
+                                                             profile) {}
+    PybBasicXmlStream &_enter() {
+        Stream::_enter();
         return *this;
     }
     bool _exit(py::args /* args */) {
-        _close();
+        this->_close();
         return false; // Propogate any exception
     }
+    // Write a str or (name, attrs[, children]) and its descendants in one
+    // call, any elements opened are closed if there is an exception.
+    void writeTree(py::handle node) {
+        size_t depth = this->depth();
+        try {
+            _writeNode(node);
+        } catch (...) {
+            try {
+                while (this->depth() > depth) {
+                    this->_endElementAt(this->depth());
+                }
+            } catch (ExceptionXml &) {
+                // The stream is already failing.
+            }
+            throw;
+        }
+    }
+protected:
+    void _writeNode(py::handle node) {
+        if (py::isinstance<py::str>(node)) {
+            this->characters(node.cast<XmlStringView>());
+            return;
+        }
+        py::ssize_t size = 0;
+        if (py::isinstance<py::tuple>(node) || py::isinstance<py::list>(node)) {
+            size = PySequence_Fast_GET_SIZE(node.ptr());
+        }
+        if (size != 2 && size != 3) {
+            throw py::type_error(
+                "A node to writeTree() must be a str or a tuple or list of"
+                " (name, attrs[, children]) not \""
+                + std::string(Py_TYPE(node.ptr())->tp_name) + "\"");
+        }
+        py::sequence seq = py::reinterpret_borrow<py::sequence>(node);
+        py::object name = seq[0];
+        py::object attrs = seq[1];
+        if (Py_EnterRecursiveCall(" in writeTree()")) {
+            throw py::error_already_set();
+        }
+        struct LeaveRecursiveCall {
+            ~LeaveRecursiveCall() { Py_LeaveRecursiveCall(); }
+        } leave;
+        if (attrs.is_none()) {
+            this->startElement(name.cast<XmlStringView>(), tAttrs());
+        } else if (! py::isinstance<py::dict>(attrs)) {
+            throw py::type_error(
+                "The attrs in writeTree() must be a dict or None not \""
+                + std::string(Py_TYPE(attrs.ptr())->tp_name) + "\"");
+        } else {
+            this->startElement(name.cast<XmlStringView>(), attrs.cast<tAttrs>());
+        }
+        size_t depth = this->depth();
+        if (size == 3) {
+            py::object children = seq[2];
+            if (py::isinstance<py::str>(children)) {
+                _writeNode(children);
+            } else if (py::isinstance<py::tuple>(children) || py::isinstance<py::list>(children)) {
+                for (py::handle child: children) {
+                    _writeNode(child);
+                }
+            } else {
+                throw py::type_error(
+                    "The children in writeTree() must be a str, tuple or list not \""
+                    + std::string(Py_TYPE(children.ptr())->tp_name) + "\"");
+            }
+        }
+        this->_endElementAt(depth);
+    }
 };
 
-class PybXhtmlStream : public PybXmlStream {
+template <typename Stream>
+class PybBasicXhtmlStream : public PybBasicXmlStream<Stream> {
 public:
-    PybXhtmlStream(const std::string &theEnc/* ='utf-8'*/,
-                   const std::string &theDtdLocal /* =None */,
-                   int theId /* =0 */,
-                   bool mustIndent /* =True */) : PybXmlStream(theEnc, theDtdLocal, theId, mustIndent) {}
-    PybXhtmlStream &_enter() {
-        PybXmlStream::_enter();
-        m_output << "\n<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\"";
-        m_output << " \"http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\">";
-        startElement("html", ROOT_ATTRIBUTES);
+    PybBasicXhtmlStream(const std::string &theEnc/* ='utf-8'*/,
+                        const std::string &theDtdLocal /* =None */,
+                        int theId /* =0 */,
+                        bool mustIndent /* =True */,
+                        py::object theFile /* =None */,
+                        size_t flushSize,
+                        size_t sizeHint /* =0 */,
+                        const std::string &profile /* ='' */,
+                        bool background /* =False */,
+                        py::object compression /* =None */,
+                        int compressionLevel /* =-1 */,
+                        size_t compressionSyncSize /* =0 */,
+                        size_t compressionThreads /* =1 */,
+                        size_t compressionBlockSize /* =0 */) : PybBasicXmlStream<Stream>(
+                            theEnc, theDtdLocal, theId, mustIndent, theFile, flushSize,
+                            sizeHint, profile, background, compression,
+                            compressionLevel, compressionSyncSize,
+                            compressionThreads, compressionBlockSize) {}
+    PybBasicXhtmlStream &_enter() {
+        PybBasicXmlStream<Stream>::_enter();
+        this->m_output << "\n<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\"";
+        this->m_output << " \"http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\">";
+        this->startElement("html", XHTML_ROOT_ATTRIBUTES);
         return *this;
     }
     bool _exit(py::args /* args */) {
-        _close();
+        this->_close();
         return false; // Propogate any exception
     }
-    void charactersWithBr(const std::string &sIn) {
-        size_t index = 0;
-        while (index < sIn.size()) {
-            size_t found = sIn.find("\n", index);
-            if (found != std::string::npos) {
-                std::string slice(sIn, index, found - index);
-                characters(slice);
-                startElement("br", tAttrs());
-                endElement("br");
-                index = found + 1;
-            } else {
-                if (index < sIn.size()) {
-                    std::string slice(sIn, index);
-                    characters(slice);
-                    break;
-                }
+    void charactersWithBr(XmlStringView sIn) {
+        const char *begin = sIn.data();
+        const char *end = begin + sIn.size();
+        while (begin < end) {
+            const char *found = static_cast<const char *>(std::memchr(begin, '\n', end - begin));
+            if (! found) {
+                this->characters(XmlStringView(begin, end - begin));
+                break;
             }
+            this->characters(XmlStringView(begin, found - begin));
+            this->startElement("br", tAttrs());
+            this->endElement("br");
+            begin = found + 1;
         }
     }
+};
+
+/**
+ * Exports the in memory document of a stream through the buffer protocol
+ * without copying it. The stream buffer is pinned for the lifetime of this
+ * object so that it can not move, this holds a reference to the stream.
+ * The caller must check that the stream has an in memory document.
+ */
+class PybStreamBuffer {
+public:
+    PybStreamBuffer(py::object theStream, XmlBuffer &theOutput) : _stream(theStream),
+        _output(theOutput) {
+        _output.pin();
+    }
+    ~PybStreamBuffer() {
+        _output.unpin();
+    }
+    py::buffer_info get_buffer_info() {
+        const std::string &value = _output.str();
+        return py::buffer_info(const_cast<char *>(value.data()), 1, "B",
+                               static_cast<ssize_t>(value.size()));
+    }
 protected:
-    const tAttrs ROOT_ATTRIBUTES = {
-        { "xmlns", "http://www.w3.org/1999/xhtml"},
-        { "xml:lang", "en" },
-        { "lang" , "en" },
-    };
+    py::object _stream;
+    XmlBuffer &_output;
 };
 
-class PybElement : public Element {
+/**
+ * An element that writes its start tag on __enter__. This holds the Python
+ * name and the converted attributes until then and afterwards only the
+ * depth of the element in the stream. The stream is kept alive by the
+ * py::keep_alive in the binding.
+ */
+template <typename Stream>
+class PybBasicElement {
 public:
-    PybElement(PybXmlStream &theXmlStream,
-               const std::string &theElemName,
-               const tAttrs &theAttrs=tAttrs()) : Element(
-                    *(static_cast<XmlStream*>(&theXmlStream)),
-                    theElemName,
-                    theAttrs) {}
-    PybElement(PybXhtmlStream &theXmlStream,
-               const std::string &theElemName,
-               const tAttrs &theAttrs=tAttrs()) : Element(
-                  *(static_cast<XmlStream*>(&theXmlStream)),
-                  theElemName,
-                  theAttrs) {}
-    PybElement &_enter() {
-        Element::_enter();
+    PybBasicElement(PybBasicXmlStream<Stream> &theXmlStream,
+                    py::str theElemName,
+                    const tAttrs &theAttrs=tAttrs()) : _stream(theXmlStream),
+                    _name(theElemName),
+                    _attrs(theAttrs),
+                    _depth(0) {}
+    PybBasicElement &_enter() {
+        Py_ssize_t size;
+        const char *data = PyUnicode_AsUTF8AndSize(_name.ptr(), &size);
+        if (! data) {
+            throw py::error_already_set();
+        }
+        _stream.startElement(XmlStringView(data, static_cast<size_t>(size)), _attrs);
+        _depth = _stream.depth();
         return *this;
     }
+    void _close() {
+        _stream._endElementAt(_depth);
+        _depth = 0;
+    }
     bool _exit(py::args /* args */) {
         _close();
         return false; // Propogate any exception
     }
+protected:
+    PybBasicXmlStream<Stream> &_stream;
+    py::str _name;
+    tAttrs _attrs;
+    size_t _depth;
 };
 
-PYBIND11_MODULE(pbXmlWrite, m) {
-    m.doc() = R"pbdoc(
-        XmlWriter with Pybind11
-        -----------------------
-
-        .. currentmodule:: pbXmlWrite
+/**
+ * Bind an XmlStream, XhtmlStream and Element for one set of policies. The
+ * names are those of the Python classes.
+ */
+template <typename Stream>
+static void bind_streams(py::module &m,
+                         const char *xml_name,
+                         const char *xhtml_name,
+                         const char *element_name) {
+    using tXml = PybBasicXmlStream<Stream>;
+    using tXhtml = PybBasicXhtmlStream<Stream>;
+    using tElement = PybBasicElement<Stream>;
 
-        .. autosummary::
-            :toctree: _generate
-    
-            ExceptionXml
-            ExceptionXmlEndElement
-            encodeString
-            decodeString
-            nameFromString
-            XmlStream
-            XhtmlStream
-            Element
-    )pbdoc";
-    
-    // Exceptions
-    py::register_exception<ExceptionXml>(m, "ExceptionXml");
-    py::register_exception<ExceptionXmlEndElement>(m, "ExceptionXmlEndElement");
-    
-    // Global to decide error action. This is ignored, we always raise.
-    m.attr("RAISE_ON_ERROR") = RAISE_ON_ERROR;
-    
-    // base64 encoding and decoding
-    m.def("encodeString", &encodeString, DOCSTRING_XmlWrite_encodeString,
-          py::arg("theS"),
-          py::arg("theCharPrefix")="_"
-          );
-    // NOTE: The way we have to return bytes by creating a lambda wrapper.
-    m.def("decodeString",
-          [](const std::string & theS) {
-              return py::bytes(decodeString(theS));
-          },
-          DOCSTRING_XmlWrite_decodeString
-          );
-    m.def("nameFromString", &nameFromString, DOCSTRING_XmlWrite_nameFromString);
-    
     // The XmlStream class but masquerading as a PybXmlStream
-    py::class_<PybXmlStream>(m, "XmlStream", DOCSTRING_XmlWrite_XmlStream)
-        .def(py::init<const std::string &, const std::string &, int, bool>(),
+    py::class_<tXml>(m, xml_name, DOCSTRING_XmlWrite_XmlStream)
+        .def(py::init<const std::string &, const std::string &, int, bool,
+                      py::object, size_t, size_t, const std::string &, bool,
+                      py::object, int, size_t, size_t, size_t>(),
              DOCSTRING_XmlWrite_XmlStream___init__,
              py::arg("theEnc")="utf-8",
              py::arg("theDtdLocal")="",
              py::arg("theId")=0,
-             py::arg("mustIndent")=true)
-        .def("getvalue", &XmlStream::getvalue,
+             py::arg("mustIndent")=true,
+             py::arg("theFile")=py::none(),
+             py::arg("flushSize")=XmlBuffer::DEFAULT_FLUSH_SIZE,
+             py::arg("sizeHint")=0,
+             py::arg("profile")="",
+             py::arg("background")=false,
+             py::arg("compression")=py::none(),
+             py::arg("compressionLevel")=Z_DEFAULT_COMPRESSION,
+             py::arg("compressionSyncSize")=0,
+             py::arg("compressionThreads")=1,
+             py::arg("compressionBlockSize")=0)
+        .def("getvalue", &Stream::getvalue,
              DOCSTRING_XmlWrite_XmlStream_getvalue)
-        .def_property_readonly("id", &XmlStream::id,
+        .def("getvalue_bytes",
+             [](tXml &self) {
+                 const std::string &value = self.getbuffer();
+                 return py::bytes(value.data(), value.size());
+             },
+             "Returns the document as UTF-8 bytes.")
+        .def("getbuffer",
+             [](py::object self) {
+                 tXml &stream = self.cast<tXml &>();
+                 // Raises if there is no in memory document.
+                 stream.getbuffer();
+                 return py::memoryview(
+                    py::cast(new PybStreamBuffer(self, stream.output()),
+                             py::return_value_policy::take_ownership));
+             },
+             "Returns a memoryview of the UTF-8 document without copying it.\n"
+             "Writing to the stream raises an ExceptionXml until the memoryview is released.")
+        .def("writeTo",
+             [](const tXml &self, py::object theFile) {
+                 int fd = PyObject_AsFileDescriptor(theFile.ptr());
+                 if (fd < 0) {
+                     throw py::error_already_set();
+                 }
+                 self.writeTo(fd);
+             },
+             "Writes the UTF-8 document to a file descriptor or an object with a fileno() method.\n"
+             "This avoids joining a large document into one string, any Python buffering is bypassed.")
+        .def("drain",
+             [](tXml &self) {
+                 return py::bytes(self.drain());
+             },
+             "Returns the UTF-8 bytes written since the last drain() and releases their memory.\n"
+             "The result may end part way through a start tag, the concatenation of all\n"
+             "the results is the complete document.")
+        .def("reset", (void (Stream::*)()) &Stream::reset,
+             "Discard the document so that the stream can be reused, the memory is kept.\n"
+             "This raises an ExceptionXml if the stream is writing to a file.")
+        .def_property_readonly("id", &Stream::id,
                                "A unique ID in this stream. The ID is incremented on each call.")
-        .def_property_readonly("_canIndent", &XmlStream::_canIndent,
+        .def_property_readonly("_canIndent", &Stream::_canIndent,
                                "Returns True if indentation is possible (no mixed content etc.).")
-        .def("_flipIndent", &XmlStream::_flipIndent,
+        .def_property("sortAttributes",
+                      (bool (Stream::*)() const) &Stream::sortAttributes,
+                      (void (Stream::*)(bool)) &Stream::sortAttributes,
+                      "True (the default) writes attributes sorted by name, False in the"
+                      " order they were given. reset() restores True.")
+        .def_property("indentString",
+                      [](const Stream &self) { return self.indentString(); },
+                      [](Stream &self, const std::string &indent) {
+                          if (indent.find_first_not_of(" \t") != std::string::npos) {
+                              throw py::value_error(
+                                  "\"indentString\" must only contain spaces and tabs");
+                          }
+                          self.indentString(indent);
+                      },
+                      "The string written once per level of indentation, spaces and tabs"
+                      " only. The default is two spaces and reset() restores it. This is"
+                      " always empty for the Fast streams that do not indent.")
+        .def("_flipIndent", &Stream::_flipIndent,
              DOCSTRING_XmlWrite_XmlStream__flipIndent)
-        .def("xmlSpacePreserve", &XmlStream::xmlSpacePreserve,
+        .def("xmlSpacePreserve", &Stream::xmlSpacePreserve,
              DOCSTRING_XmlWrite_XmlStream_xmlSpacePreserve)
-        .def("startElement", &XmlStream::startElement,
+        .def("startElement", &Stream::startElement,
              DOCSTRING_XmlWrite_XmlStream_startElement)
-        .def("characters", &XmlStream::characters,
+        .def("characters", &Stream::characters,
              DOCSTRING_XmlWrite_XmlStream_characters)
-        .def("literal", &XmlStream::literal,
+        .def("literal", &Stream::literal,
              DOCSTRING_XmlWrite_XmlStream_literal)
-        .def("comment", &XmlStream::comment,
+        .def("comment", &Stream::comment,
              DOCSTRING_XmlWrite_XmlStream_comment,
              py::arg("theS"),
              py::arg("newLine")=false
              )
-        .def("pI", &XmlStream::pI, DOCSTRING_XmlWrite_XmlStream_pI)
-        .def("endElement", &XmlStream::endElement,
+        .def("pI", &Stream::pI, DOCSTRING_XmlWrite_XmlStream_pI)
+        .def("endElement", &Stream::endElement,
              DOCSTRING_XmlWrite_XmlStream_endElement)
-        .def("writeECMAScript", &XmlStream::writeECMAScript,
+        .def("writeECMAScript", &Stream::writeECMAScript,
              DOCSTRING_XmlWrite_XmlStream_writeECMAScript)
-        .def("writeCDATA", &XmlStream::writeCDATA,
+        .def("writeCDATA", &Stream::writeCDATA,
              DOCSTRING_XmlWrite_XmlStream_writeCDATA)
-        .def("writeCSS", &XmlStream::writeCDATA,
+        .def("writeCSS", &Stream::writeCSS,
              DOCSTRING_XmlWrite_XmlStream_writeCSS)
-        .def("_indent", &XmlStream::_indent,
+        .def("writeTree", &tXml::writeTree,
+             "Writes a subtree in one call. A node is either a str, written as characters,\n"
+             "or a tuple or list of (name, attrs[, children]) where attrs is a dict or None\n"
+             "and children is a str or a list or tuple of nodes.\n"
+             "The escaping and indentation are the same as startElement(), characters()\n"
+             "and endElement().")
+        .def("execute", &Stream::execute,
+             "Writes the operations recorded in a CommandBuffer. If this raises the\n"
+             "operations before the failing one have been written.")
+        .def("_indent", &Stream::_indent,
              DOCSTRING_XmlWrite_XmlStream__indent)
-        .def("_closeElemIfOpen", &XmlStream::_closeElemIfOpen,
+        .def("_closeElemIfOpen", &Stream::_closeElemIfOpen,
              DOCSTRING_XmlWrite_XmlStream__closeElemIfOpen)
-        .def("_encode", &XmlStream::_encode,
+        .def("_encode", &Stream::_encode,
              DOCSTRING_XmlWrite_XmlStream__encode)
-        .def("__enter__", &PybXmlStream::_enter,
+        .def("__enter__", &tXml::_enter,
              DOCSTRING_XmlWrite_XmlStream___enter__)
-        .def("__exit__", &PybXmlStream::_exit,
+        .def("__exit__", &tXml::_exit,
              DOCSTRING_XmlWrite_XmlStream___exit__)
         ;
 
     // The XhtmlStream class
-    py::class_<PybXhtmlStream, PybXmlStream>(m, "XhtmlStream", DOCSTRING_XmlWrite_XhtmlStream)
-        .def(py::init<const std::string &, const std::string &, int, bool>(),
+    py::class_<tXhtml, tXml>(m, xhtml_name, DOCSTRING_XmlWrite_XhtmlStream)
+        .def(py::init<const std::string &, const std::string &, int, bool,
+                      py::object, size_t, size_t, const std::string &, bool,
+                      py::object, int, size_t, size_t, size_t>(),
              DOCSTRING_XmlWrite_XhtmlStream___init__,
              py::arg("theEnc")="utf-8",
              py::arg("theDtdLocal")="",
              py::arg("theId")=0,
-             py::arg("mustIndent")=true)
-        .def("__enter__", &PybXhtmlStream::_enter, DOCSTRING_XmlWrite_XhtmlStream___enter__)//, py::return_value_policy::reference_internal)
-        .def("__exit__", &PybXhtmlStream::_exit,
+             py::arg("mustIndent")=true,
+             py::arg("theFile")=py::none(),
+             py::arg("flushSize")=XmlBuffer::DEFAULT_FLUSH_SIZE,
+             py::arg("sizeHint")=0,
+             py::arg("profile")="",
+             py::arg("background")=false,
+             py::arg("compression")=py::none(),
+             py::arg("compressionLevel")=Z_DEFAULT_COMPRESSION,
+             py::arg("compressionSyncSize")=0,
+             py::arg("compressionThreads")=1,
+             py::arg("compressionBlockSize")=0)
+        .def("__enter__", &tXhtml::_enter, DOCSTRING_XmlWrite_XhtmlStream___enter__)//, py::return_value_policy::reference_internal)
+        .def("__exit__", &tXhtml::_exit,
              DOCSTRING_XmlWrite_XhtmlStream___exit__)
-        .def("charactersWithBr", &PybXhtmlStream::charactersWithBr, DOCSTRING_XmlWrite_XhtmlStream_charactersWithBr)
+        .def("charactersWithBr", &tXhtml::charactersWithBr, DOCSTRING_XmlWrite_XhtmlStream_charactersWithBr)
     ;
-    
+
     // The element class
-    py::class_<PybElement>(m, "Element", DOCSTRING_XmlWrite_Element)
-        .def(py::init<PybXmlStream &, const std::string &, const tAttrs &>(),
-             DOCSTRING_XmlWrite_Element___init__,
-             py::arg("theXmlStream"),
-             py::arg("theName"),
-             py::arg("theAttrs")=tAttrs())
-        .def(py::init<PybXhtmlStream &, const std::string &, const tAttrs &>(),
+    py::class_<tElement>(m, element_name, DOCSTRING_XmlWrite_Element)
+        // Also accepts an XhtmlStream as that derives from XmlStream.
+        .def(py::init<tXml &, py::str, const tAttrs &>(),
              DOCSTRING_XmlWrite_Element___init__,
+             py::keep_alive<1, 2>(),
              py::arg("theXmlStream"),
              py::arg("theName"),
              py::arg("theAttrs")=tAttrs())
-        .def("__enter__", &PybElement::_enter,
+        .def("__enter__", &tElement::_enter,
              DOCSTRING_XmlWrite_Element___enter__)
-        .def("__exit__", &PybElement::_exit,
+        .def("__exit__", &tElement::_exit,
              DOCSTRING_XmlWrite_Element___exit__)
+        .def("_close", &tElement::_close, "Close the element.")
     ;
+}
+
+PYBIND11_MODULE(pbXmlWrite, m) {
+    m.doc() = R"pbdoc(
+        XmlWriter with Pybind11
+        -----------------------
+
+        .. currentmodule:: pbXmlWrite
+
+        .. autosummary::
+            :toctree: _generate
+    
+            ExceptionXml
+            ExceptionXmlEndElement
+            encodeString
+            decodeString
+            nameFromString
+            XmlStream
+            XhtmlStream
+            Element
+            XmlStreamFast
+            XhtmlStreamFast
+            ElementFast
+    )pbdoc";
+    
+    // Exceptions
+    XmlBlockingSection::setHooks(blocking_section_begin, blocking_section_end);
+
+    py::register_exception<ExceptionXml>(m, "ExceptionXml");
+    py::register_exception<ExceptionXmlEndElement>(m, "ExceptionXmlEndElement");
+    
+    // Global to decide error action. This is ignored, we always raise.
+    m.attr("RAISE_ON_ERROR") = RAISE_ON_ERROR;
     
+    // base64 encoding and decoding
+    m.def("encodeString", &encodeString, DOCSTRING_XmlWrite_encodeString,
+          py::arg("theS"),
+          py::arg("theCharPrefix")="_"
+          );
+    // NOTE: The way we have to return bytes by creating a lambda wrapper.
+    m.def("decodeString",
+          [](const std::string & theS) {
+              return py::bytes(decodeString(theS));
+          },
+          DOCSTRING_XmlWrite_decodeString
+          );
+    m.def("nameFromString", &nameFromString, DOCSTRING_XmlWrite_nameFromString);
+    
+    py::class_<PybStreamBuffer>(m, "_StreamBuffer", py::buffer_protocol())
+        .def_buffer([](PybStreamBuffer &b) { return b.get_buffer_info(); });
+
+    py::class_<XmlCommandBuffer>(m, "CommandBuffer",
+                                 "A batch of start(), text() and end() operations for XmlStream.execute().")
+        .def(py::init<>())
+        .def("start",
+             [](XmlCommandBuffer &self, XmlStringView name, py::object attrs) {
+                 if (attrs.is_none()) {
+                     self.start(name);
+                 } else if (! py::isinstance<py::dict>(attrs)) {
+                     throw py::type_error(
+                         "Argument \"attrs\" to start() must be dict or None not \""
+                         + std::string(Py_TYPE(attrs.ptr())->tp_name) + "\"");
+                 } else {
+                     self.start(name, attrs.cast<tAttrs>());
+                 }
+             },
+             "Record a startElement(name, attrs), attrs is a dict or None.",
+             py::arg("name"),
+             py::arg("attrs")=py::none())
+        .def("text", (void (XmlCommandBuffer::*)(XmlStringView)) &XmlCommandBuffer::text,
+             "Record a characters(text), consecutive text is joined.")
+        .def("end", &XmlCommandBuffer::end,
+             "Record the end of the innermost open element.")
+        .def("clear", &XmlCommandBuffer::clear,
+             "Discard the recorded operations so that the buffer can be reused.")
+        .def("__len__", &XmlCommandBuffer::size);
+
+    bind_streams<XmlStream>(m, "XmlStream", "XhtmlStream", "Element");
+    // These do not indent or check end element names, the output is
+    // otherwise the same.
+    bind_streams<XmlStreamFast>(m, "XmlStreamFast", "XhtmlStreamFast", "ElementFast");
+
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
 #else
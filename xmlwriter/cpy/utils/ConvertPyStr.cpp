@@ -13,6 +13,21 @@
 
 namespace CPythonCpp {
 
+const char *
+py_unicode_as_utf8(PyObject *py_str, Py_ssize_t *size) {
+    assert(CPythonCpp::cpython_asserts(py_str));
+#if PY_MAJOR_VERSION >= 3
+    // Encodes any kind, 1, 2 or 4 byte, and caches the result in py_str.
+    return PyUnicode_AsUTF8AndSize(py_str, size);
+#else
+    char *data = NULL;
+    if (PyString_AsStringAndSize(py_str, &data, size)) {
+        return NULL;
+    }
+    return data;
+#endif
+}
+
 /* Convert a PyObject to a std::string.
  * If py_str is Unicode than treat it as UTF-8.
  * This works with Python 2.7 and Python 3.4 onwards.
@@ -23,26 +38,10 @@ std::string py_utf8_to_std_string(PyObject *py_str) {
     std::string r;
 
     if (PyUnicode_Check(py_str)) {
-        if (! PyUnicode_READY(py_str)) {
-            if (PyUnicode_KIND(py_str) == PyUnicode_1BYTE_KIND) {
-                // Python 3 and its minor versions (they vary)
-                //    const Py_UCS1 *pChrs = PyUnicode_1BYTE_DATA(pyStr);
-                //    result = std::string(reinterpret_cast<const char*>(pChrs));
-#if PY_MAJOR_VERSION >= 3
-                r = std::string((char*)PyUnicode_1BYTE_DATA(py_str));
-#else
-                // Nasty cast away constness because PyString_AsString takes non-const in Py2
-                r = std::string((char*)PyString_AsString(const_cast<PyObject *>(py_str)));
-#endif
-            } else {
-                PyErr_Format(PyExc_ValueError,
-                             "In %s \"py_str\" not utf-8",
-                             __FUNCTION__);
-            }
-        } else {
-            PyErr_Format(PyExc_ValueError,
-                         "In %s \"py_str\" failed PyUnicode_READY()",
-                         __FUNCTION__);
+        Py_ssize_t size;
+        const char *data = py_unicode_as_utf8(py_str, &size);
+        if (data) {
+            r.assign(data, static_cast<size_t>(size));
         }
     } else {
         PyErr_Format(PyExc_TypeError,
@@ -58,26 +57,10 @@ py_utf8_to_up_std_string(PyObject *py_str) {
     std::unique_ptr<std::string> r;
 
     if (PyUnicode_Check(py_str)) {
-        if (! PyUnicode_READY(py_str)) {
-            if (PyUnicode_KIND(py_str) == PyUnicode_1BYTE_KIND) {
-                // Python 3 and its minor versions (they vary)
-                //    const Py_UCS1 *pChrs = PyUnicode_1BYTE_DATA(pyStr);
-                //    result = std::string(reinterpret_cast<const char*>(pChrs));
-#if PY_MAJOR_VERSION >= 3
-                r.reset(new std::string((char*)PyUnicode_1BYTE_DATA(py_str)));
-#else
-                // Nasty cast away constness because PyString_AsString takes non-const in Py2
-                r.reset(new std::string((char*)PyString_AsString(const_cast<PyObject *>(py_str))));
-#endif
-            } else {
-                PyErr_Format(PyExc_ValueError,
-                             "In %s \"py_str\" not utf-8",
-                             __FUNCTION__);
-            }
-        } else {
-            PyErr_Format(PyExc_ValueError,
-                         "In %s \"py_str\" failed PyUnicode_READY()",
-                         __FUNCTION__);
+        Py_ssize_t size;
+        const char *data = py_unicode_as_utf8(py_str, &size);
+        if (data) {
+            r.reset(new std::string(data, static_cast<size_t>(size)));
         }
     } else {
         PyErr_Format(PyExc_TypeError,
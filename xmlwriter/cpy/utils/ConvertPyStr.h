@@ -24,6 +24,13 @@ py_utf8_to_std_string(PyObject *py_str);
 PyObject *
 std_string_to_py_utf8(const std::string &str);
 
+/* The UTF-8 of a str of any kind as a pointer and a length without a copy.
+ * This is the UTF-8 cached by the str so it is valid while py_str is alive.
+ * Returns NULL with an error set on failure, for example a lone surrogate.
+ */
+const char *
+py_unicode_as_utf8(PyObject *py_str, Py_ssize_t *size);
+
 std::unique_ptr<std::string>
 py_utf8_to_up_std_string(PyObject *py_str);
 